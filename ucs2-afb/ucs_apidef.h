@@ -32,17 +32,56 @@ static const char _afb_description_v2_UNICENS[] =
     ":{\"description\":\"configure Unicens2 lib from NetworkConfig.XML.\",\"g"
     "et\":{\"x-permissions\":{\"$ref\":\"#/components/x-permissions/config\"}"
     ",\"parameters\":[{\"in\":\"query\",\"name\":\"filename\",\"required\":tr"
-    "ue,\"schema\":{\"type\":\"string\"}}],\"responses\":{\"200\":{\"$ref\":\""
-    "#/components/responses/200\"}}}},\"/subscribe\":{\"description\":\"Subsc"
-    "ribe to UNICENS Events.\",\"get\":{\"x-permissions\":{\"$ref\":\"#/compo"
-    "nents/x-permissions/monitor\"},\"responses\":{\"200\":{\"$ref\":\"#/comp"
-    "onents/responses/200\"}}}},\"/writei2c\":{\"description\":\"Writes I2C c"
-    "ommand to remote node.\",\"get\":{\"x-permissions\":{\"$ref\":\"#/compon"
-    "ents/x-permissions/monitor\"},\"parameters\":[{\"in\":\"query\",\"name\""
-    ":\"node\",\"required\":true,\"schema\":{\"type\":\"integer\",\"format\":"
-    "\"int32\"}},{\"in\":\"query\",\"name\":\"data\",\"required\":true,\"sche"
-    "ma\":{\"type\":\"array\",\"format\":\"int32\"},\"style\":\"simple\"}],\""
-    "responses\":{\"200\":{\"$ref\":\"#/components/responses/200\"}}}}}}"
+    "ue,\"schema\":{\"type\":\"string\"}},{\"in\":\"query\",\"name\":\"timera"
+    "ccuracy\",\"required\":false,\"schema\":{\"type\":\"integer\",\"format\""
+    ":\"int64\"}},{\"in\":\"query\",\"name\":\"iothread\",\"required\":false,"
+    "\"schema\":{\"type\":\"boolean\"}},{\"in\":\"query\",\"name\":\"rtprio\""
+    ",\"required\":false,\"schema\":{\"type\":\"integer\",\"format\":\"int32\""
+    "}},{\"in\":\"query\",\"name\":\"cpu\",\"required\":false,\"schema\":{\"t"
+    "ype\":\"integer\",\"format\":\"int32\"}},{\"in\":\"query\",\"name\":\"cm"
+    "dqueue\",\"required\":false,\"schema\":{\"type\":\"integer\",\"format\":"
+    "\"int32\"}},{\"in\":\"query\",\"name\":\"cmdqueuemax\",\"required\":fals"
+    "e,\"schema\":{\"type\":\"integer\",\"format\":\"int32\"}},{\"in\":\"quer"
+    "y\",\"name\":\"cmdpolicy\",\"required\":false,\"schema\":{\"type\":\"str"
+    "ing\",\"enum\":[\"reject\",\"dropoldest\",\"coalesce\"]}},{\"in\":\"quer"
+    "y\",\"name\":\"scriptconcurrency\",\"required\":false,\"schema\":{\"type"
+    "\":\"integer\",\"format\":\"int32\"}},{\"in\":\"query\",\"name\":\"scrip"
+    "tpolicy\",\"required\":false,\"schema\":{\"type\":\"string\",\"enum\":[\""
+    "always\",\"skipunchanged\"]}}],\"responses\":{\"200\":{\"$ref\":\"#/comp"
+    "onents/responses/200\"}}}},\"/subscribe\":{\"description\":\"Subscribe t"
+    "o UNICENS Events, or to the AMS messages of one message id.\",\"get\":{\""
+    "x-permissions\":{\"$ref\":\"#/components/x-permissions/monitor\"},\"para"
+    "meters\":[{\"in\":\"query\",\"name\":\"amsid\",\"required\":false,\"sche"
+    "ma\":{\"type\":\"integer\",\"format\":\"int32\"}}],\"responses\":{\"200\""
+    ":{\"$ref\":\"#/components/responses/200\"}}}},\"/writei2c\":{\"descripti"
+    "on\":\"Writes I2C command to remote node.\",\"get\":{\"x-permissions\":{"
+    "\"$ref\":\"#/components/x-permissions/monitor\"},\"parameters\":[{\"in\""
+    ":\"query\",\"name\":\"node\",\"required\":true,\"schema\":{\"type\":\"in"
+    "teger\",\"format\":\"int32\"}},{\"in\":\"query\",\"name\":\"data\",\"req"
+    "uired\":true,\"schema\":{\"type\":\"array\",\"format\":\"int32\"},\"styl"
+    "e\":\"simple\"}],\"responses\":{\"200\":{\"$ref\":\"#/components/respons"
+    "es/200\"}}}},\"/stats\":{\"description\":\"Get UNICENS binding runtime s"
+    "tatistics.\",\"get\":{\"x-permissions\":{\"$ref\":\"#/components/x-permi"
+    "ssions/monitor\"},\"responses\":{\"200\":{\"$ref\":\"#/components/respon"
+    "ses/200\"}}}},\"/nodes\":{\"description\":\"Get the runtime state of all"
+    " nodes, or of the given one.\",\"get\":{\"x-permissions\":{\"$ref\":\"#/"
+    "components/x-permissions/monitor\"},\"parameters\":[{\"in\":\"query\",\""
+    "name\":\"node\",\"required\":false,\"schema\":{\"type\":\"integer\",\"fo"
+    "rmat\":\"int32\"}}],\"responses\":{\"200\":{\"$ref\":\"#/components/resp"
+    "onses/200\"}}}},\"/latency\":{\"description\":\"Get queue wait and execu"
+    "tion time histograms per command type.\",\"get\":{\"x-permissions\":{\"$"
+    "ref\":\"#/components/x-permissions/monitor\"},\"parameters\":[{\"in\":\""
+    "query\",\"name\":\"reset\",\"required\":false,\"schema\":{\"type\":\"boo"
+    "lean\"}}],\"responses\":{\"200\":{\"$ref\":\"#/components/responses/200\""
+    "}}}},\"/trace\":{\"description\":\"Get recorded XRM, node script and UNI"
+    "CENS stack trace events, decoded to text or raw.\",\"get\":{\"x-permissi"
+    "ons\":{\"$ref\":\"#/components/x-permissions/monitor\"},\"parameters\":["
+    "{\"in\":\"query\",\"name\":\"since\",\"required\":false,\"schema\":{\"ty"
+    "pe\":\"integer\",\"format\":\"int64\"}},{\"in\":\"query\",\"name\":\"max"
+    "\",\"required\":false,\"schema\":{\"type\":\"integer\",\"format\":\"int3"
+    "2\"}},{\"in\":\"query\",\"name\":\"raw\",\"required\":false,\"schema\":{"
+    "\"type\":\"boolean\"}}],\"responses\":{\"200\":{\"$ref\":\"#/components/"
+    "responses/200\"}}}}}}"
 ;
 
 static const struct afb_auth _afb_auths_v2_UNICENS[] = {
@@ -54,6 +93,10 @@ static const struct afb_auth _afb_auths_v2_UNICENS[] = {
  void ucs2_initialise(struct afb_req req);
  void ucs2_subscribe(struct afb_req req);
  void ucs2_writei2c(struct afb_req req);
+ void ucs2_stats(struct afb_req req);
+ void ucs2_nodes(struct afb_req req);
+ void ucs2_latency(struct afb_req req);
+ void ucs2_trace(struct afb_req req);
 
 static const struct afb_verb_v2 _afb_verbs_v2_UNICENS[] = {
     {
@@ -74,7 +117,7 @@ static const struct afb_verb_v2 _afb_verbs_v2_UNICENS[] = {
         .verb = "subscribe",
         .callback = ucs2_subscribe,
         .auth = &_afb_auths_v2_UNICENS[1],
-        .info = "Subscribe to UNICENS Events.",
+        .info = "Subscribe to UNICENS Events, or to the AMS messages of one message id.",
         .session = AFB_SESSION_NONE_V2
     },
     {
@@ -84,6 +127,34 @@ static const struct afb_verb_v2 _afb_verbs_v2_UNICENS[] = {
         .info = "Writes I2C command to remote node.",
         .session = AFB_SESSION_NONE_V2
     },
+    {
+        .verb = "stats",
+        .callback = ucs2_stats,
+        .auth = &_afb_auths_v2_UNICENS[1],
+        .info = "Get UNICENS binding runtime statistics.",
+        .session = AFB_SESSION_NONE_V2
+    },
+    {
+        .verb = "nodes",
+        .callback = ucs2_nodes,
+        .auth = &_afb_auths_v2_UNICENS[1],
+        .info = "Get the runtime state of all nodes, or of the given one.",
+        .session = AFB_SESSION_NONE_V2
+    },
+    {
+        .verb = "latency",
+        .callback = ucs2_latency,
+        .auth = &_afb_auths_v2_UNICENS[1],
+        .info = "Get queue wait and execution time histograms per command type.",
+        .session = AFB_SESSION_NONE_V2
+    },
+    {
+        .verb = "trace",
+        .callback = ucs2_trace,
+        .auth = &_afb_auths_v2_UNICENS[1],
+        .info = "Get recorded XRM, node script and UNICENS stack trace events, decoded to text or raw.",
+        .session = AFB_SESSION_NONE_V2
+    },
     {
         .verb = NULL,
         .callback = NULL,
@@ -23,12 +23,15 @@
 
 #define BUFFER_FRAME_COUNT 10 /* max frames in buffer */
 #define WAIT_TIMER_US 1000000 /* default waiting timer 1s */
+#define SERVICE_TIMER_ACCURACY_US 1000 /* default accuracy of UNICENS application timer 1ms */
 #define I2C_MAX_DATA_SZ    32 /* max. number of bytes to be written to i2c */
+#define AMS_MAX_EVENTS     32 /* max. number of AMS message ids with an own afb event */
 
 #include <systemd/sd-event.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
@@ -36,12 +39,20 @@
 #include <assert.h>
 #include <errno.h>
 #include <dirent.h> 
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 
 #include "ucs_binding.h"
 #include "ucs_interface.h"
 
 #define MAX_FILENAME_LEN (100)
 #define RX_BUFFER (64)
+#define TX_QUEUE_LEN (32) /* max telegrams waiting for TX cdev to become writable */
+#define TX_TELEGRAM_LEN (256) /* biggest control telegram, must reach the cdev with one write() */
 
 /** Internal structure, enabling multiple instances of this component.
  * \note Do not access any of this variables.
@@ -52,24 +63,217 @@ typedef struct {
     char fileName[MAX_FILENAME_LEN];
     uint8_t rxBuffer[RX_BUFFER];
     uint32_t rxLen;
+    sd_event_source *evtSource;
 } CdevData_t;
 
 
+/**
+ * Telegram not accepted by TX cdev yet. The cdev has no write_iter, every write() is
+ * one packet, so the segments are gathered here. The LLD message is held until written.
+ */
 typedef struct {
+    Ucs_Lld_TxMsg_t *msg;
+    uint32_t len;
+    uint8_t data[TX_TELEGRAM_LEN];
+} TxTelegram_t;
+
+/** Bounded TX ring, flushed by EPOLLOUT when cdev is writable again */
+typedef struct {
+    TxTelegram_t entries[TX_QUEUE_LEN];
+    uint32_t rdIdx;
+    uint32_t wrIdx;
+    uint32_t maxDepth;
+    uint32_t stalls;
+    uint32_t dropped;
+} TxQueue_t;
+
+/** Persistent one-shot timer (UNICENS application timer, command timer), re-armed on every request */
+typedef struct {
+    sd_event_source *evtSource;
+    uint64_t accuracy;
+} TimerData_t;
+
+/** Persistent source running UCSI_Service, requests are collapsed until it fired */
+typedef struct {
+    sd_event_source *evtSource;
+    bool pending;
+    atomic_uint requested;        /* every call of UCSI_CB_OnServiceRequired, whatever thread */
+    uint32_t executed;
+    int wakeFd;                   /* eventfd, lets foreign threads request a run */
+    sd_event_source *wakeSource;
+    atomic_bool wakePending;
+} ServiceData_t;
+
+/** AMS messages are drained after each service run and pushed as afb events from mainloop */
+typedef struct {
+    bool pending;
+    uint32_t received;
+    uint32_t batches;
+    uint32_t maxBatch;
+    uint32_t dropped;      /* lost because a batch could not be allocated or posted */
+    atomic_uint unrouted;  /* no subscription for the message id, counted on mainloop */
+} AmsRxData_t;
+
+typedef void (*JobCb_t)(void *closure);
+
+typedef struct Job {
+    JobCb_t callback;
+    void *closure;
+    struct Job *next;
+} Job_t;
+
+/** Thread-safe job FIFO, drained by the event loop watching its eventfd */
+typedef struct {
+    pthread_mutex_t mutex;
+    Job_t *head;
+    Job_t *tail;
+    int eventFd;
+    sd_event_source *evtSource;
+} JobQueue_t;
+
+/** Optional thread owning UNICENS, control cdevs and their event sources */
+typedef struct {
+    bool enabled;
+    pthread_t thread;
+    int rtPriority; /* SCHED_FIFO priority, 0 keeps default policy */
+    int cpu;        /* CPU affinity, -1 lets scheduler decide */
+    JobQueue_t toService;
+    JobQueue_t toMain;
+} IoThread_t;
+
+typedef struct {
+  sd_event *loop; /* loop servicing UNICENS: afb mainloop or I/O thread loop */
+  IoThread_t ioThread;
   CdevData_t rx;
   CdevData_t tx;
+  TxQueue_t txQueue;
+  ServiceData_t service;
+  AmsRxData_t amsRx;
+  TimerData_t timer;
+  TimerData_t cmdTimer;
   UCSI_Data_t ucsiData;
   UcsXmlVal_t* ucsConfig;
 } ucsContextT;
 
+/** One afb event per subscribed AMS message id */
+typedef struct {
+    uint16_t msgId;
+    struct afb_event event;
+} AmsEvent_t;
+
 typedef struct {
     struct afb_event node_event;
-    
+    AmsEvent_t ams[AMS_MAX_EVENTS];
+    atomic_int amsCnt;            /* published once the entry is complete, read by mainloop */
+    pthread_mutex_t amsMutex;     /* serialises subscribing verbs appending entries */
 } EventData_t;
 
 static ucsContextT *ucsContextS = NULL;
 static EventData_t *eventData = NULL;
 
+/* Run all jobs posted since last wakeup, in posting order */
+STATIC int OnJobQueueCB (sd_event_source* src, int fileFd, uint32_t revents, void* pTag) {
+    JobQueue_t *queue = (JobQueue_t*) pTag;
+    Job_t *job, *next;
+    uint64_t count;
+
+    if (read(fileFd, &count, sizeof(count)) < 0 && EAGAIN != errno)
+        AFB_NOTICE ("job queue eventfd read error (%s)", strerror(errno));
+
+    pthread_mutex_lock(&queue->mutex);
+    job = queue->head;
+    queue->head = queue->tail = NULL;
+    pthread_mutex_unlock(&queue->mutex);
+
+    for (; job; job = next) {
+        next = job->next;
+        job->callback(job->closure);
+        free(job);
+    }
+    return 0;
+}
+
+STATIC bool JobQueueInit(JobQueue_t *queue, sd_event *loop) {
+    pthread_mutex_init(&queue->mutex, NULL);
+    queue->head = queue->tail = NULL;
+    queue->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == queue->eventFd) goto OnErrorExit;
+
+    if (sd_event_add_io(loop, &queue->evtSource, queue->eventFd, EPOLLIN, OnJobQueueCB, queue) < 0) goto OnErrorExit;
+    return true;
+
+ OnErrorExit:
+    return false;
+}
+
+STATIC bool JobQueuePost(JobQueue_t *queue, JobCb_t callback, void *closure) {
+    Job_t *job = malloc(sizeof(Job_t));
+    uint64_t one = 1;
+
+    if (!job) return false;
+    job->callback = callback;
+    job->closure = closure;
+    job->next = NULL;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+    pthread_mutex_unlock(&queue->mutex);
+
+    /* wake up owning loop, counter collapses multiple posts into one wakeup */
+    if (write(queue->eventFd, &one, sizeof(one)) < 0 && EAGAIN != errno)
+        AFB_NOTICE ("job queue eventfd write error (%s)", strerror(errno));
+    return true;
+}
+
+/* Execute callback in the context owning UCSI_Data_t (I/O thread when enabled) */
+STATIC bool RunOnServiceLoop(ucsContextT *ucsContext, JobCb_t callback, void *closure) {
+    if (!ucsContext->ioThread.enabled) {
+        callback(closure);
+        return true;
+    }
+    return JobQueuePost(&ucsContext->ioThread.toService, callback, closure);
+}
+
+/* Execute callback on afb mainloop, where requests get replied and events pushed */
+STATIC bool RunOnMainLoop(ucsContextT *ucsContext, JobCb_t callback, void *closure) {
+    if (!ucsContext->ioThread.enabled) {
+        callback(closure);
+        return true;
+    }
+    return JobQueuePost(&ucsContext->ioThread.toMain, callback, closure);
+}
+
+STATIC void *IoThreadMain(void *pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    IoThread_t *ioThread = &ucsContext->ioThread;
+    struct sched_param param;
+    cpu_set_t cpuSet;
+    int err;
+
+    if (ioThread->cpu >= 0) {
+        CPU_ZERO(&cpuSet);
+        CPU_SET(ioThread->cpu, &cpuSet);
+        err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        if (err)
+            AFB_WARNING ("I/O thread: cannot bind to cpu=%d (%s)", ioThread->cpu, strerror(err));
+    }
+    if (ioThread->rtPriority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = ioThread->rtPriority;
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err)
+            AFB_WARNING ("I/O thread: cannot set SCHED_FIFO priority=%d (%s)", ioThread->rtPriority, strerror(err));
+    }
+
+    AFB_NOTICE ("I/O thread running (cpu=%d rtprio=%d)", ioThread->cpu, ioThread->rtPriority);
+    sd_event_loop(ucsContext->loop);
+    return NULL;
+}
+
 PUBLIC void UcsXml_CB_OnError(const char format[], uint16_t vargsCnt, ...) {
     /*AFB_DEBUG (afbIface, format, args); */
     va_list args;
@@ -85,24 +289,24 @@ PUBLIC void UcsXml_CB_OnError(const char format[], uint16_t vargsCnt, ...) {
     AFB_WARNING (outbuf);
 }
 
-PUBLIC uint16_t UCSI_CB_OnGetTime(void *pTag) {
+PUBLIC uint64_t UCSI_CB_OnGetTime(void *pTag) {
     struct timespec currentTime;
-    uint16_t timer;
+    uint64_t usec;
     pTag = pTag;
 
-    if (clock_gettime(CLOCK_MONOTONIC_RAW, &currentTime))   {
+    if (clock_gettime(CLOCK_MONOTONIC, &currentTime))   {
         assert(false);
         return 0;
     }
 
-    timer = (uint16_t) ((currentTime.tv_sec * 1000 ) + ( currentTime.tv_nsec / 1000000 ));
-    return(timer);
+    usec = ((uint64_t)currentTime.tv_sec * 1000000) + (currentTime.tv_nsec / 1000);
+    return(usec);
 }
 
 STATIC int onTimerCB (sd_event_source* source,uint64_t timer, void* pTag) {
     ucsContextT *ucsContext = (ucsContextT*) pTag;
 
-    sd_event_source_unref(source);
+    /* source is one-shot, it stays allocated until re-armed by UCSI_CB_OnSetServiceTimer */
     UCSI_Timeout(&ucsContext->ucsiData);
 
     return 0;
@@ -112,13 +316,38 @@ void UCSI_CB_OnNetworkState(void *pTag, bool isAvailable, uint16_t packetBandwid
 {
 }
 
+STATIC int onCmdTimerCB (sd_event_source* source,uint64_t timer, void* pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+
+    /* source is one-shot, it stays allocated until re-armed by UCSI_CB_OnSetCommandTimer */
+    UCSI_CommandTimeout(&ucsContext->ucsiData);
+
+    return 0;
+}
+
+STATIC void TimerArm(ucsContextT *ucsContext, TimerData_t *timer, uint16_t timeout) {
+    uint64_t usec;
+
+    /* a new request always replaces the pending one */
+    if (0 == timeout) {
+        sd_event_source_set_enabled(timer->evtSource, SD_EVENT_OFF);
+        return;
+    }
+    sd_event_now(ucsContext->loop, CLOCK_MONOTONIC, &usec);
+    sd_event_source_set_time(timer->evtSource, usec + (timeout*1000));
+    sd_event_source_set_enabled(timer->evtSource, SD_EVENT_ONESHOT);
+}
+
 /* UCS2 Interface Timer Callback */
 PUBLIC void UCSI_CB_OnSetServiceTimer(void *pTag, uint16_t timeout) {
-  uint64_t usec;
-  /* set a timer with  250ms accuracy */
-  sd_event_now(afb_daemon_get_event_loop(), CLOCK_BOOTTIME, &usec);
-  sd_event_add_time(afb_daemon_get_event_loop(), NULL, CLOCK_MONOTONIC, usec + (timeout*1000), 250, onTimerCB, pTag);
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    TimerArm(ucsContext, &ucsContext->timer, timeout);
+}
 
+/* UCS2 Interface command queue timer, e.g. flushing I2C bursts */
+PUBLIC void UCSI_CB_OnSetCommandTimer(void *pTag, uint16_t timeout) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    TimerArm(ucsContext, &ucsContext->cmdTimer, timeout);
 }
 
 /**
@@ -134,52 +363,278 @@ void UCSI_CB_OnUserMessage(void *pTag, bool isError, const char format[],
     va_list argptr;
     char outbuf[300];
     pTag = pTag;
+    /* only errors are shown, do not pay for formatting the rest */
+    if (!isError)
+        return;
     va_start(argptr, vargsCnt);
-    vsprintf(outbuf, format, argptr);
+    vsnprintf(outbuf, sizeof(outbuf), format, argptr);
     va_end(argptr);
-    if (isError)
-        AFB_NOTICE (outbuf);
+    AFB_NOTICE (outbuf);
+}
+
+/** Messages of one drain run, handed to mainloop at once */
+typedef struct {
+    uint8_t count;
+    struct {
+        uint16_t msgId;
+        json_object *eventJ;
+    } msgs[UCS_AMS_NUM_RX_MSGS];
+} AmsBatchJob_t;
+
+STATIC AmsEvent_t *AmsEventFind(uint16_t msgId) {
+    int i, amsCnt;
+
+    if (!eventData) return NULL;
+    amsCnt = atomic_load_explicit(&eventData->amsCnt, memory_order_acquire);
+    for (i = 0; i < amsCnt; i++) {
+        if (eventData->ams[i].msgId == msgId)
+            return &eventData->ams[i];
+    }
+    return NULL;
+}
+
+/* afb events are pushed from mainloop, the subscriptions live there */
+STATIC void PushAmsEventJob(void *closure) {
+    AmsBatchJob_t *job = (AmsBatchJob_t*) closure;
+    AmsEvent_t *amsEvent;
+    int i;
+
+    for (i = 0; i < job->count; i++) {
+        amsEvent = AmsEventFind(job->msgs[i].msgId);
+        if (amsEvent) {
+            afb_event_push(amsEvent->event, job->msgs[i].eventJ);
+        } else {
+            atomic_fetch_add(&ucsContextS->amsRx.unrouted, 1);
+            json_object_put(job->msgs[i].eventJ);
+        }
+    }
+    free(job);
+}
+
+STATIC void AmsBatchPost(ucsContextT *ucsContext, AmsBatchJob_t *job) {
+    int i;
+
+    if (job->count && RunOnMainLoop(ucsContext, PushAmsEventJob, job))
+        return;
+    if (job->count)
+        AFB_WARNING ("ams: batch of %d messages lost", job->count);
+    for (i = 0; i < job->count; i++)
+        json_object_put(job->msgs[i].eventJ);
+    ucsContext->amsRx.dropped += job->count;
+    free(job);
+}
+
+/*
+ * Copies every pending AMS message out of the UNICENS RX pool and releases it
+ * right away, so subscribers never hold pool memory. Runs on the service loop
+ * after UCSI_Service, not within UNICENS context.
+ */
+STATIC void AmsRxDrain(ucsContextT *ucsContext) {
+    AmsBatchJob_t *job = NULL;
+    json_object *eventJ, *dataJ;
+    uint16_t msgId, sourceAddr;
+    uint8_t *payload;
+    uint32_t payloadLen, i, batch = 0;
+
+    ucsContext->amsRx.pending = false;
+    while (UCSI_GetAmsMessage(&ucsContext->ucsiData, &msgId, &sourceAddr, &payload, &payloadLen)) {
+        if (!job)
+            job = calloc(1, sizeof(AmsBatchJob_t));
+        if (job) {
+            eventJ = json_object_new_object();
+            dataJ = json_object_new_array();
+            for (i = 0; i < payloadLen; i++)
+                json_object_array_add(dataJ, json_object_new_int(payload[i]));
+            json_object_object_add(eventJ, "msgid", json_object_new_int(msgId));
+            json_object_object_add(eventJ, "source", json_object_new_int(sourceAddr));
+            json_object_object_add(eventJ, "data", dataJ);
+            job->msgs[job->count].msgId = msgId;
+            job->msgs[job->count].eventJ = eventJ;
+            job->count++;
+        } else {
+            ucsContext->amsRx.dropped++;
+        }
+        UCSI_ReleaseAmsMessage(&ucsContext->ucsiData);
+        ucsContext->amsRx.received++;
+        batch++;
+
+        if (job && UCS_AMS_NUM_RX_MSGS == job->count) {
+            AmsBatchPost(ucsContext, job);
+            job = NULL;
+        }
+    }
+    if (job)
+        AmsBatchPost(ucsContext, job);
+    if (batch) {
+        ucsContext->amsRx.batches++;
+        if (batch > ucsContext->amsRx.maxBatch)
+            ucsContext->amsRx.maxBatch = batch;
+    }
 }
 
 /** UCSI_Service cannot be called directly within UNICENS context, need to service stack through mainloop */
-STATIC int OnServiceRequiredCB (sd_event_source *source, uint64_t usec, void *pTag) {
+STATIC int OnServiceRequiredCB (sd_event_source *source, void *pTag) {
     ucsContextT *ucsContext = (ucsContextT*) pTag;
 
-    sd_event_source_unref(source);
+    /* clear flag first, requests raised while servicing need a further run */
+    ucsContext->service.pending = false;
+    ucsContext->service.executed++;
     UCSI_Service(&ucsContext->ucsiData);
+    if (ucsContext->amsRx.pending)
+        AmsRxDrain(ucsContext);
     return (0);
 }
 
+/* true, if the caller runs the loop owning the service sources. Unknown counts as foreign. */
+STATIC bool OnServiceLoop(ucsContextT *ucsContext) {
+    pid_t loopTid;
+
+    if (ucsContext->ioThread.enabled)
+        return pthread_equal(pthread_self(), ucsContext->ioThread.thread);
+    /* afb mainloop may move between worker threads, ask sd-event who runs it */
+    if (sd_event_get_tid(ucsContext->loop, &loopTid) < 0)
+        return false;
+    return (loopTid == (pid_t) syscall(SYS_gettid));
+}
+
+/* Arm persistent defer source, only ever called on the loop owning the service sources */
+STATIC void ServiceArm(ucsContextT *ucsContext) {
+    if (ucsContext->service.pending) return;
+
+    /* any further request before it fires is served by the same run */
+    ucsContext->service.pending = true;
+    sd_event_source_set_enabled(ucsContext->service.evtSource, SD_EVENT_ONESHOT);
+}
+
+/* Service request raised by a foreign thread, now running on the loop owning UNICENS */
+STATIC int OnServiceWakeupCB (sd_event_source* src, int fileFd, uint32_t revents, void* pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    uint64_t count;
+
+    if (read(fileFd, &count, sizeof(count)) < 0 && EAGAIN != errno)
+        AFB_NOTICE ("service eventfd read error (%s)", strerror(errno));
+    atomic_store(&ucsContext->service.wakePending, false);
+    ServiceArm(ucsContext);
+    return 0;
+}
+
 /* UCS Callback fire when ever UNICENS needs to be serviced */
 PUBLIC void UCSI_CB_OnServiceRequired(void *pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    uint64_t one = 1;
+
+    atomic_fetch_add_explicit(&ucsContext->service.requested, 1, memory_order_relaxed);
+    if (OnServiceLoop(ucsContext)) {
+        ServiceArm(ucsContext);
+        return;
+    }
 
-   /* push an asynchronous request for loopback to call UCSI_Service */
-   sd_event_add_time(afb_daemon_get_event_loop(), NULL, CLOCK_MONOTONIC, 0, 0, OnServiceRequiredCB, pTag);
+    /* commands submitted by verbs: sd-event sources belong to the loop, wake it up once */
+    if (!atomic_exchange(&ucsContext->service.wakePending, true)
+        && write(ucsContext->service.wakeFd, &one, sizeof(one)) < 0)
+        AFB_NOTICE ("service eventfd write error (%s)", strerror(errno));
+}
+
+/* Write queued telegrams until TX cdev would block, EPOLLOUT resumes the flush */
+STATIC void TxFlush(ucsContextT *ucsContext) {
+    CdevData_t *cdevTx = &ucsContext->tx;
+    TxQueue_t *txQueue = &ucsContext->txQueue;
+
+    while (txQueue->rdIdx != txQueue->wrIdx) {
+        TxTelegram_t *tel = &txQueue->entries[txQueue->rdIdx % TX_QUEUE_LEN];
+        ssize_t written = write(cdevTx->fileHandle, tel->data, tel->len);
+        if (0 > written && EAGAIN == errno) {
+            txQueue->stalls++;
+            if (cdevTx->evtSource)
+                sd_event_source_set_enabled(cdevTx->evtSource, SD_EVENT_ON);
+            return;
+        }
+        if (0 > written) {
+            AFB_NOTICE ("TX cdev write error (%s), telegram lost", strerror(errno));
+            txQueue->dropped++;
+        }
+        else if ((uint32_t) written != tel->len) {
+            /* the remainder would become a packet of its own, INIC cannot take it */
+            AFB_NOTICE ("TX cdev short write (%zd of %u bytes), telegram lost", written, tel->len);
+            txQueue->dropped++;
+        }
+        /* kernel owns the data now, give LLD message back to UNICENS */
+        txQueue->rdIdx++;
+        UCSI_TxRelease(&ucsContext->ucsiData, tel->msg);
+    }
+    if (cdevTx->evtSource)
+        sd_event_source_set_enabled(cdevTx->evtSource, SD_EVENT_OFF);
+}
+
+/* Callback fire when TX cdev accepts data again */
+STATIC int onWriteCB (sd_event_source* src, int fileFd, uint32_t revents, void* pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+
+    TxFlush(ucsContext);
+    return 0;
 }
 
 /* Callback when ever this UNICENS wants to send a message to INIC. */
-PUBLIC void UCSI_CB_OnTxRequest(void *pTag, const uint8_t *pData, uint32_t len) {
+PUBLIC void UCSI_CB_OnTxRequest(void *pTag, const struct iovec *pIov, int iovCnt, Ucs_Lld_TxMsg_t *pMsg) {
     ucsContextT *ucsContext = (ucsContextT*) pTag;
     CdevData_t *cdevTx = &ucsContext->tx;
-    uint32_t total = 0;
+    TxQueue_t *txQueue = &ucsContext->txQueue;
+    TxTelegram_t *tel;
+    uint32_t depth, len;
+    int i;
 
-    if (NULL == pData || 0 == len) return;
+    if (NULL == pIov || 0 == iovCnt || iovCnt > TX_MAX_SEGMENTS) goto OnDropExit;
 
-    if (O_RDONLY == cdevTx->fileFlags) return;
+    if (O_RDONLY == cdevTx->fileFlags) goto OnDropExit;
     if (-1 == cdevTx->fileHandle)
         cdevTx->fileHandle = open(cdevTx->fileName, cdevTx->fileFlags);
     if (-1 == cdevTx->fileHandle)
-        return;
+        goto OnDropExit;
 
-    while(total < len) {
-        ssize_t written = write(cdevTx->fileHandle, &pData[total], (len - total));
-        if (0 >= written)
-        {
-            /* Silently ignore write error (only occur in non-blocking mode) */
-            break;
+    depth = txQueue->wrIdx - txQueue->rdIdx;
+    if (depth >= TX_QUEUE_LEN) {
+        AFB_NOTICE ("TX queue overflow (depth=%d), telegram lost", depth);
+        goto OnDropExit;
+    }
+
+    /* keep telegram order: append to queue, then write as much as the cdev accepts */
+    tel = &txQueue->entries[txQueue->wrIdx % TX_QUEUE_LEN];
+    for (i = 0, len = 0; i < iovCnt; len += pIov[i].iov_len, i++) {
+        if (len + pIov[i].iov_len > TX_TELEGRAM_LEN) {
+            AFB_NOTICE ("TX telegram exceeds TX_TELEGRAM_LEN=%d, telegram lost", TX_TELEGRAM_LEN);
+            goto OnDropExit;
         }
-        total += (uint32_t) written;
+        memcpy(&tel->data[len], pIov[i].iov_base, pIov[i].iov_len);
     }
+    tel->len = len;
+    tel->msg = pMsg;
+    txQueue->wrIdx++;
+    if (++depth > txQueue->maxDepth)
+        txQueue->maxDepth = depth;
+
+    if (1 == depth)
+        TxFlush(ucsContext);
+    return;
+
+ OnDropExit:
+    txQueue->dropped++;
+    UCSI_TxRelease(&ucsContext->ucsiData, pMsg);
+}
+
+/* LLD is stopped: queued telegrams point into memory UNICENS is about to reclaim */
+PUBLIC void UCSI_CB_OnTxStop(void *pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    CdevData_t *cdevTx = &ucsContext->tx;
+    TxQueue_t *txQueue = &ucsContext->txQueue;
+
+    while (txQueue->rdIdx != txQueue->wrIdx) {
+        TxTelegram_t *tel = &txQueue->entries[txQueue->rdIdx % TX_QUEUE_LEN];
+        txQueue->rdIdx++;
+        txQueue->dropped++;
+        UCSI_TxRelease(&ucsContext->ucsiData, tel->msg);
+    }
+    if (cdevTx->evtSource)
+        sd_event_source_set_enabled(cdevTx->evtSource, SD_EVENT_OFF);
 }
 
 /** UcsXml_FreeVal can not be called directly within UNICENS context, need to service stack through mainloop */
@@ -200,15 +655,17 @@ STATIC int OnStopCB (sd_event_source *source, uint64_t usec, void *pTag) {
 void UCSI_CB_OnStop(void *pTag) {
     AFB_NOTICE ("UNICENS stopped");
    /* push an asynchronous request for loopback to call UcsXml_FreeVal */
-   sd_event_add_time(afb_daemon_get_event_loop(), NULL, CLOCK_MONOTONIC, 0, 0, OnStopCB, pTag);
+   sd_event_add_time(((ucsContextT*) pTag)->loop, NULL, CLOCK_MONOTONIC, 0, 0, OnStopCB, pTag);
 }
 
 /** This callback will be raised, when ever an applicative message on the control channel arrived */
 void UCSI_CB_OnAmsMessageReceived(void *pTag)
 {
-	/* If not interested, just ignore this event.
-	   Otherwise UCSI_GetAmsMessage may now be called asynchronous (mainloop) to get the content. 
-	   Don't forget to call UCSI_ReleaseAmsMessage after that */
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+
+    /* UCSI_GetAmsMessage may not be called within UNICENS context, drain after the service run */
+    ucsContext->amsRx.pending = true;
+    UCSI_CB_OnServiceRequired(pTag);
 }
 
 void UCSI_CB_OnRouteResult(void *pTag, uint16_t routeId, bool isActive, uint16_t connectionLabel)
@@ -219,8 +676,19 @@ void UCSI_CB_OnGpioStateChange(void *pTag, uint16_t nodeAddress, uint8_t gpioPin
 {
 }
 
-PUBLIC void UCSI_CB_OnMgrReport(void *pTag, Ucs_MgrReport_t code, uint16_t nodeAddress, Ucs_Rm_Node_t *pNode){
+/* afb events are pushed from mainloop, the subscription lives there */
+STATIC void PushNodeEventJob(void *closure) {
+    json_object *j_event_info = (json_object*) closure;
+
+    if (eventData)
+        afb_event_push(eventData->node_event, j_event_info);
+    else
+        json_object_put(j_event_info);
+}
 
+PUBLIC void UCSI_CB_OnMgrReport(void *pTag, Ucs_MgrReport_t code, uint16_t nodeAddress, Ucs_Rm_Node_t *pNode){
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+    json_object *j_event_info;
     bool available;
     
     if (code == UCS_MGR_REP_AVAILABLE) {
@@ -234,14 +702,12 @@ PUBLIC void UCSI_CB_OnMgrReport(void *pTag, Ucs_MgrReport_t code, uint16_t nodeA
         return;
     }
     
-    if (eventData) {
-        
-        json_object *j_event_info = json_object_new_object();
-        json_object_object_add(j_event_info, "node", json_object_new_int(nodeAddress));
-        json_object_object_add(j_event_info, "available", json_object_new_boolean(available));
-        
-        afb_event_push(eventData->node_event, j_event_info);
-    }     
+    j_event_info = json_object_new_object();
+    json_object_object_add(j_event_info, "node", json_object_new_int(nodeAddress));
+    json_object_object_add(j_event_info, "available", json_object_new_boolean(available));
+
+    if (!RunOnMainLoop(ucsContext, PushNodeEventJob, j_event_info))
+        json_object_put(j_event_info);
 }
 
 bool Cdev_Init(CdevData_t *d, const char *fileName, bool read, bool write)
@@ -281,21 +747,42 @@ static bool InitializeCdevs(ucsContextT *ucsContext)
 /* Callback fire when something is avaliable on MOST cdev */
 int onReadCB (sd_event_source* src, int fileFd, uint32_t revents, void* pTag) {
     ucsContextT *ucsContext =( ucsContextT*) pTag;
+    Ucs_Lld_RxMsg_t *msg;
     ssize_t len;
-    uint8_t pBuffer[RX_BUFFER];
-    int ok;
 
-    len = read (ucsContext->rx.fileHandle, &pBuffer, sizeof(pBuffer));
-    if (0 == len)
-        return 0;
-    ok= UCSI_ProcessRxData(&ucsContext->ucsiData, pBuffer, (uint16_t)len);
-    if (!ok) {
-        AFB_DEBUG ("Buffer overrun (not handle)");
-        /* Buffer overrun could replay pBuffer */
+    /* drain non-blocking cdev until EAGAIN, so a burst of telegrams costs a single mainloop round-trip.
+       Telegrams are read straight into UNICENS LLD buffers (no intermediate copy) */
+    UCSI_RxBatchBegin(&ucsContext->ucsiData);
+    for (;;) {
+        msg = UCSI_RxAllocate(&ucsContext->ucsiData, RX_BUFFER);
+        if (!msg) {
+            /* no LLD buffer free: leave telegrams in kernel queue until UCSI_CB_OnRxBufferAvailable */
+            sd_event_source_set_enabled(src, SD_EVENT_OFF);
+            break;
+        }
+        len = read (ucsContext->rx.fileHandle, msg->data_ptr, RX_BUFFER);
+        if (0 >= len) {
+            UCSI_RxDiscard(&ucsContext->ucsiData, msg);
+            break;
+        }
+        UCSI_RxCommit(&ucsContext->ucsiData, msg, (uint16_t)len);
     }
+    UCSI_RxBatchEnd(&ucsContext->ucsiData);
     return 0;
 }
 
+/* UCS Callback fire when LLD buffers got free again, resume reading MOST cdev */
+PUBLIC void UCSI_CB_OnRxBufferAvailable(void *pTag) {
+    ucsContextT *ucsContext = (ucsContextT*) pTag;
+
+    if (ucsContext->rx.evtSource)
+        sd_event_source_set_enabled(ucsContext->rx.evtSource, SD_EVENT_ON);
+}
+
+/* UCS Callback fire when AMS TX messages got free again, the binding does not send AMS yet */
+PUBLIC void UCSI_CB_OnAmsTxAvailable(void *pTag) {
+}
+
 STATIC UcsXmlVal_t* ParseFile(struct afb_req request) {
     char *xmlBuffer;
     ssize_t readSize;
@@ -340,44 +827,258 @@ STATIC UcsXmlVal_t* ParseFile(struct afb_req request) {
     return NULL;
 }
 
+/** Config change in flight, applied where UCSI_Data_t lives and replied on mainloop */
+typedef struct {
+    struct afb_req request;
+    UcsXmlVal_t *ucsConfig;
+    const char *accuracy;
+    const char *scriptPolicy;
+    bool success;
+} NewConfigJob_t;
+
+STATIC void NewConfigReplyJob(void *closure) {
+    NewConfigJob_t *job = (NewConfigJob_t*) closure;
+
+    if (job->success)
+        afb_req_success(job->request, NULL, "UNICENS-active");
+    else
+        afb_req_fail_f (job->request, "UNICENS-init", "Fail to initialize UNICENS");
+
+    afb_req_unref(job->request);
+    free(job);
+}
+
+STATIC void NewConfigJob(void *closure) {
+    NewConfigJob_t *job = (NewConfigJob_t*) closure;
+    ucsContextT *ucsContext = ucsContextS;
+
+    /* Optional accuracy of UNICENS application timer in microseconds */
+    if (job->accuracy) {
+        ucsContext->timer.accuracy = strtoull(job->accuracy, NULL, 0);
+        /* sd-event treats 0 as its 250ms default, the tightest accuracy is 1us */
+        if (ucsContext->timer.accuracy == 0)
+            ucsContext->timer.accuracy = 1;
+        sd_event_source_set_time_accuracy(ucsContext->timer.evtSource, ucsContext->timer.accuracy);
+    }
+
+    /* Optional reuse of node scripts, which did not change since they last succeeded */
+    if (job->scriptPolicy) {
+        if (!strcasecmp(job->scriptPolicy, "skipunchanged"))
+            UCSI_SetScriptPolicy(&ucsContext->ucsiData, UCSI_ScriptPolicy_SkipUnchanged);
+        else if (!strcasecmp(job->scriptPolicy, "always"))
+            UCSI_SetScriptPolicy(&ucsContext->ucsiData, UCSI_ScriptPolicy_Always);
+        else
+            AFB_WARNING ("scriptpolicy=%s unknown, keeping current one", job->scriptPolicy);
+    }
+
+    /* Initialise UNICENS with parsed config */
+    ucsContext->ucsConfig = job->ucsConfig;
+    job->success = UCSI_NewConfig(&ucsContext->ucsiData, ucsContext->ucsConfig);
+
+    if (!RunOnMainLoop(ucsContext, NewConfigReplyJob, job))
+        AFB_WARNING ("initialise: reply lost");
+}
+
+/* Optional I/O thread has to be selected with first initialise, later calls only load new XML */
+STATIC bool IoThreadSetup(ucsContextT *ucsContext, struct afb_req request) {
+    IoThread_t *ioThread = &ucsContext->ioThread;
+    const char *value;
+
+    value = afb_req_value(request, "iothread");
+    ioThread->enabled = (value && (!strcasecmp(value, "true") || !strcmp(value, "1")));
+    value = afb_req_value(request, "rtprio");
+    ioThread->rtPriority = value ? atoi(value) : 0;
+    value = afb_req_value(request, "cpu");
+    ioThread->cpu = value ? atoi(value) : -1;
+
+    if (!ioThread->enabled)
+        ucsContext->loop = afb_daemon_get_event_loop();
+    else if (sd_event_new(&ucsContext->loop) < 0)
+        goto OnErrorExit;
+
+    /* service requests from other threads always go through this eventfd, whatever the mode */
+    ucsContext->service.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == ucsContext->service.wakeFd) goto OnErrorExit;
+    if (sd_event_add_io(ucsContext->loop, &ucsContext->service.wakeSource, ucsContext->service.wakeFd, EPOLLIN, OnServiceWakeupCB, ucsContext) < 0) goto OnErrorExit;
+    if (!ioThread->enabled) return true;
+
+    if (!JobQueueInit(&ioThread->toService, ucsContext->loop)) goto OnErrorExit;
+    if (!JobQueueInit(&ioThread->toMain, afb_daemon_get_event_loop())) goto OnErrorExit;
+    return true;
+
+ OnErrorExit:
+    return false;
+}
+
+/* Parses a 32 bit value (decimal, hex or octal), returns false on garbage, sign or overflow */
+STATIC bool ParseUint32(const char *value, uint32_t *result) {
+    unsigned long number;
+    char *end;
+
+    /* strtoul would negate "-1" into a huge value */
+    if (strchr(value, '-')) return false;
+    errno = 0;
+    number = strtoul(value, &end, 0);
+    if (errno || end == value || *end != '\0' || number > UINT32_MAX)
+        return false;
+    *result = (uint32_t)number;
+    return true;
+}
+
+/* Same for 16 bit values */
+STATIC bool ParseUint16(const char *value, uint16_t *result) {
+    uint32_t number;
+
+    if (!ParseUint32(value, &number) || number > 0xFFFF)
+        return false;
+    *result = (uint16_t)number;
+    return true;
+}
+
+/* Optional command pool sizing, *pCfg stays NULL to keep UCSI defaults */
+STATIC bool CmdQueueSetup(struct afb_req request, UCSI_CmdQueueCfg_t *cfg, const UCSI_CmdQueueCfg_t **pCfg) {
+    const char *capacity = afb_req_value(request, "cmdqueue");
+    const char *maxCapacity = afb_req_value(request, "cmdqueuemax");
+    const char *policy = afb_req_value(request, "cmdpolicy");
+    const char *maxScripts = afb_req_value(request, "scriptconcurrency");
+    uint16_t value;
+
+    *pCfg = NULL;
+    if (!capacity && !maxCapacity && !policy && !maxScripts) return true;
+
+    cfg->capacity = CMD_QUEUE_LEN;
+    if (capacity && (!ParseUint16(capacity, &cfg->capacity) || !cfg->capacity)) {
+        afb_req_fail_f (request, "cmdqueue-error", "cmdqueue=%s must be within 1..65535", capacity);
+        return false;
+    }
+    cfg->maxCapacity = CMD_QUEUE_MAX_LEN;
+    if (maxCapacity && (!ParseUint16(maxCapacity, &cfg->maxCapacity) || !cfg->maxCapacity)) {
+        afb_req_fail_f (request, "cmdqueue-error", "cmdqueuemax=%s must be within 1..65535", maxCapacity);
+        return false;
+    }
+    cfg->maxScripts = 0; /* UCSI default */
+    if (maxScripts) {
+        if (!ParseUint16(maxScripts, &value) || value < 1 || value > CMD_MAX_IN_FLIGHT) {
+            afb_req_fail_f (request, "cmdqueue-error", "scriptconcurrency=%s must be within 1..%d", maxScripts, CMD_MAX_IN_FLIGHT);
+            return false;
+        }
+        cfg->maxScripts = (uint8_t)value;
+    }
+    cfg->policy = UCSI_QueuePolicy_Reject;
+    if (policy && !strcasecmp(policy, "dropoldest"))
+        cfg->policy = UCSI_QueuePolicy_DropOldest;
+    else if (policy && !strcasecmp(policy, "coalesce"))
+        cfg->policy = UCSI_QueuePolicy_Coalesce;
+    else if (policy && strcasecmp(policy, "reject")) {
+        afb_req_fail_f (request, "cmdqueue-error", "cmdpolicy=%s unknown, use reject, dropoldest or coalesce", policy);
+        return false;
+    }
+    *pCfg = cfg;
+    return true;
+}
+
 PUBLIC void ucs2_initialise (struct afb_req request) {
     static ucsContextT ucsContext = { 0 };
 
-    sd_event_source *evtSource;
+    NewConfigJob_t *job;
+    UcsXmlVal_t *ucsConfig;
+    UCSI_CmdQueueCfg_t cmdQueueCfg;
+    const UCSI_CmdQueueCfg_t *cmdQueue;
     int err;
 
     /* Read and parse XML file */
-    ucsContext.ucsConfig = ParseFile (request);
-    if (NULL == ucsContext.ucsConfig) goto OnErrorExit;
+    ucsConfig = ParseFile (request);
+    if (NULL == ucsConfig) goto OnErrorExit;
 
     /* When ucsContextS is set, do not initalize UNICENS, CDEVs or system hooks, just load new XML */
     if (!ucsContextS)
     {
+        if (!CmdQueueSetup(request, &cmdQueueCfg, &cmdQueue)) goto OnErrorExit;
+
+        if (!IoThreadSetup(&ucsContext, request)) {
+            afb_req_fail_f (request, "iothread-error", "Fail to setup UNICENS I/O thread");
+            goto OnErrorExit;
+        }
+
         if (!ucsContextS && !InitializeCdevs(&ucsContext))  {
             afb_req_fail_f (request, "devnit-error", "Fail to initialise device [rx=%s tx=%s]", CONTROL_CDEV_RX, CONTROL_CDEV_TX);
             goto OnErrorExit;
         }
 
+        /* one persistent source per instance to call UCSI_Service, armed on request */
+        err = sd_event_add_defer(ucsContext.loop, &ucsContext.service.evtSource, OnServiceRequiredCB, &ucsContext);
+        if (err < 0) {
+            afb_req_fail_f (request, "register-mainloop", "Cannot hook events to mainloop");
+            goto OnErrorExit;
+        }
+        sd_event_source_set_enabled(ucsContext.service.evtSource, SD_EVENT_OFF);
+
+        /* one persistent UNICENS application timer, armed on request */
+        ucsContext.timer.accuracy = SERVICE_TIMER_ACCURACY_US;
+        err = sd_event_add_time(ucsContext.loop, &ucsContext.timer.evtSource, CLOCK_MONOTONIC, 0, ucsContext.timer.accuracy, onTimerCB, &ucsContext);
+        if (err < 0) {
+            afb_req_fail_f (request, "register-mainloop", "Cannot hook events to mainloop");
+            goto OnErrorExit;
+        }
+        sd_event_source_set_enabled(ucsContext.timer.evtSource, SD_EVENT_OFF);
+
+        /* one persistent command queue timer, armed on request */
+        ucsContext.cmdTimer.accuracy = SERVICE_TIMER_ACCURACY_US;
+        err = sd_event_add_time(ucsContext.loop, &ucsContext.cmdTimer.evtSource, CLOCK_MONOTONIC, 0, ucsContext.cmdTimer.accuracy, onCmdTimerCB, &ucsContext);
+        if (err < 0) {
+            afb_req_fail_f (request, "register-mainloop", "Cannot hook events to mainloop");
+            goto OnErrorExit;
+        }
+        sd_event_source_set_enabled(ucsContext.cmdTimer.evtSource, SD_EVENT_OFF);
+
         /* Initialise UNICENS Config Data Structure */
-        UCSI_Init(&ucsContext.ucsiData, &ucsContext);
+        UCSI_Init(&ucsContext.ucsiData, &ucsContext, cmdQueue);
 
         /* register aplayHandle file fd into binder mainloop */
-        err = sd_event_add_io(afb_daemon_get_event_loop(), &evtSource, ucsContext.rx.fileHandle, EPOLLIN, onReadCB, &ucsContext);
+        err = sd_event_add_io(ucsContext.loop, &ucsContext.rx.evtSource, ucsContext.rx.fileHandle, EPOLLIN, onReadCB, &ucsContext);
         if (err < 0) {
             afb_req_fail_f (request, "register-mainloop", "Cannot hook events to mainloop");
             goto OnErrorExit;
         }
 
+        /* TX cdev is only watched while telegrams are pending */
+        err = sd_event_add_io(ucsContext.loop, &ucsContext.tx.evtSource, ucsContext.tx.fileHandle, EPOLLOUT, onWriteCB, &ucsContext);
+        if (err < 0) {
+            afb_req_fail_f (request, "register-mainloop", "Cannot hook events to mainloop");
+            goto OnErrorExit;
+        }
+        sd_event_source_set_enabled(ucsContext.tx.evtSource, SD_EVENT_OFF);
+
+        /* from now on only the I/O thread touches UCSI_Data_t and the sources above */
+        if (ucsContext.ioThread.enabled) {
+            err = pthread_create(&ucsContext.ioThread.thread, NULL, IoThreadMain, &ucsContext);
+            if (err) {
+                afb_req_fail_f (request, "iothread-error", "Cannot start UNICENS I/O thread err=%s", strerror(err));
+                goto OnErrorExit;
+            }
+        }
+
         /* save this in a statical variable until ucs2vol move to C */
         ucsContextS = &ucsContext;
     }
-    /* Initialise UNICENS with parsed config */
-    if (!UCSI_NewConfig(&ucsContext.ucsiData, ucsContext.ucsConfig))   {
+
+    job = calloc(1, sizeof(NewConfigJob_t));
+    if (!job) {
         afb_req_fail_f (request, "UNICENS-init", "Fail to initialize UNICENS");
         goto OnErrorExit;
     }
+    job->request = request;
+    job->ucsConfig = ucsConfig;
+    job->accuracy = afb_req_value(request, "timeraccuracy");
+    job->scriptPolicy = afb_req_value(request, "scriptpolicy");
+    afb_req_addref(request);
 
-    afb_req_success(request,NULL,"UNICENS-active");
+    if (!RunOnServiceLoop(&ucsContext, NewConfigJob, job)) {
+        afb_req_fail_f (request, "UNICENS-init", "Fail to initialize UNICENS");
+        afb_req_unref(request);
+        free(job);
+        goto OnErrorExit;
+    }
 
  OnErrorExit:
     return;
@@ -434,13 +1135,53 @@ PUBLIC void ucs2_listconfig (struct afb_req request) {
     return;
 }
 
+/* subscribe to AMS messages of one message id, the event is created on first use */
+STATIC void AmsSubscribe(struct afb_req request, uint16_t msgId) {
+    AmsEvent_t *amsEvent;
+    char name[16];
+    int amsCnt;
+
+    pthread_mutex_lock(&eventData->amsMutex);
+    amsEvent = AmsEventFind(msgId);
+    if (!amsEvent) {
+        amsCnt = atomic_load_explicit(&eventData->amsCnt, memory_order_relaxed);
+        if (AMS_MAX_EVENTS == amsCnt) {
+            pthread_mutex_unlock(&eventData->amsMutex);
+            afb_req_fail_f (request, "create-event", "Too many AMS message ids, max=%d", AMS_MAX_EVENTS);
+            return;
+        }
+        snprintf(name, sizeof(name), "ams-%04X", msgId);
+        amsEvent = &eventData->ams[amsCnt];
+        amsEvent->msgId = msgId;
+        amsEvent->event = afb_daemon_make_event (name);
+        if (!afb_event_is_valid(amsEvent->event)) {
+            pthread_mutex_unlock(&eventData->amsMutex);
+            afb_req_fail_f (request, "create-event", "Cannot create or register event %s", name);
+            return;
+        }
+        /* mainloop may look up the new entry from now on */
+        atomic_store_explicit(&eventData->amsCnt, amsCnt + 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&eventData->amsMutex);
+
+    if (afb_req_subscribe(request, amsEvent->event) != 0) {
+        afb_req_fail_f (request, "subscribe-event", "Cannot subscribe to event");
+        return;
+    }
+    afb_req_success(request,NULL,"event subscription successful");
+}
+
 PUBLIC void ucs2_subscribe (struct afb_req request) {
+    const char *amsId = afb_req_value(request, "amsid");
+    uint16_t msgId;
     
     if (!eventData) {
         
-        eventData = malloc(sizeof(EventData_t));
+        eventData = calloc(1, sizeof(EventData_t));
         if (eventData) {
             eventData->node_event = afb_daemon_make_event ("node-availibility");
+            atomic_init(&eventData->amsCnt, 0);
+            pthread_mutex_init(&eventData->amsMutex, NULL);
         }
         
         if (!eventData || !afb_event_is_valid(eventData->node_event)) {
@@ -448,6 +1189,15 @@ PUBLIC void ucs2_subscribe (struct afb_req request) {
             goto OnExitError;
         }
     }
+
+    if (amsId) {
+        if (!ParseUint16(amsId, &msgId)) {
+            afb_req_fail_f (request, "subscribe-event", "Invalid amsid=%s, must be within 0..0xFFFF", amsId);
+            goto OnExitError;
+        }
+        AmsSubscribe(request, msgId);
+        goto OnExitError;
+    }
     
     if (afb_req_subscribe(request, eventData->node_event) != 0) {
         
@@ -461,38 +1211,490 @@ OnExitError:
     return;
 }
 
+STATIC json_object *RxStatsToJson(UCSI_Data_t *ucsiData) {
+    UCSI_RxStats_t stats;
+    json_object *rxJ, *histoJ;
+    int i;
+
+    UCSI_GetRxStats(ucsiData, &stats);
+    rxJ = json_object_new_object();
+    json_object_object_add(rxJ, "wakeups", json_object_new_int64(stats.wakeups));
+    json_object_object_add(rxJ, "frames", json_object_new_int64(stats.frames));
+    json_object_object_add(rxJ, "rejected", json_object_new_int64(stats.rejected));
+    json_object_object_add(rxJ, "max_frames_per_wakeup", json_object_new_int(stats.maxFramesPerWakeup));
+    histoJ = json_object_new_array();
+    for (i = 0; i < RX_BATCH_HISTO_LEN; i++)
+        json_object_array_add(histoJ, json_object_new_int64(stats.framesPerWakeup[i]));
+    json_object_object_add(rxJ, "frames_per_wakeup", histoJ);
+    return rxJ;
+}
+
+STATIC json_object *TxStatsToJson(TxQueue_t *txQueue) {
+    json_object *txJ = json_object_new_object();
+
+    json_object_object_add(txJ, "depth", json_object_new_int64(txQueue->wrIdx - txQueue->rdIdx));
+    json_object_object_add(txJ, "max_depth", json_object_new_int64(txQueue->maxDepth));
+    json_object_object_add(txJ, "stalls", json_object_new_int64(txQueue->stalls));
+    json_object_object_add(txJ, "dropped", json_object_new_int64(txQueue->dropped));
+    return txJ;
+}
+
+STATIC json_object *CmdStatsToJson(UCSI_Data_t *ucsiData) {
+    static const char *laneNames[UCSI_LANE_COUNT] = { "lifecycle", "routing", "gpio", "bulk" };
+    UCSI_CmdStats_t stats;
+    json_object *cmdJ, *laneJ, *poolJ, *restartJ;
+    int i;
+
+    UCSI_GetCmdStats(ucsiData, &stats);
+    cmdJ = json_object_new_object();
+    json_object_object_add(cmdJ, "in_flight", json_object_new_int(stats.inFlight));
+    json_object_object_add(cmdJ, "scripts_in_flight", json_object_new_int(stats.scriptsInFlight));
+    poolJ = json_object_new_object();
+    json_object_object_add(poolJ, "capacity", json_object_new_int(stats.pool.capacity));
+    json_object_object_add(poolJ, "used", json_object_new_int(stats.pool.used));
+    json_object_object_add(poolJ, "high_water", json_object_new_int(stats.pool.highWater));
+    json_object_object_add(poolJ, "grown", json_object_new_int64(stats.pool.grown));
+    json_object_object_add(poolJ, "dropped", json_object_new_int64(stats.pool.dropped));
+    json_object_object_add(poolJ, "coalesced", json_object_new_int64(stats.pool.coalesced));
+    json_object_object_add(poolJ, "gpio_merged", json_object_new_int64(stats.pool.gpioMerged));
+    json_object_object_add(poolJ, "i2c_bursts", json_object_new_int64(stats.pool.i2cBursts));
+    json_object_object_add(poolJ, "i2c_burst_merged", json_object_new_int64(stats.pool.i2cBurstMerged));
+    json_object_object_add(poolJ, "rejected", json_object_new_int64(stats.pool.rejected));
+    json_object_object_add(poolJ, "ingress_rejected", json_object_new_int64(stats.pool.ingressRejected));
+    json_object_object_add(poolJ, "expired", json_object_new_int64(stats.pool.expired));
+    json_object_object_add(poolJ, "late_results", json_object_new_int64(stats.pool.lateResults));
+    json_object_object_add(cmdJ, "pool", poolJ);
+    restartJ = json_object_new_object();
+    json_object_object_add(restartJ, "warm", json_object_new_int64(stats.restart.warm));
+    json_object_object_add(restartJ, "routes_restored", json_object_new_int64(stats.restart.routesRestored));
+    json_object_object_add(restartJ, "scripts_skipped", json_object_new_int64(stats.restart.scriptsSkipped));
+    json_object_object_add(restartJ, "scripts_unchanged", json_object_new_int64(stats.restart.scriptsUnchanged));
+    json_object_object_add(cmdJ, "restart", restartJ);
+    for (i = 0; i < UCSI_LANE_COUNT; i++) {
+        laneJ = json_object_new_object();
+        json_object_object_add(laneJ, "depth", json_object_new_int(stats.lanes[i].depth));
+        json_object_object_add(laneJ, "max_depth", json_object_new_int(stats.lanes[i].maxDepth));
+        json_object_object_add(laneJ, "dispatched", json_object_new_int64(stats.lanes[i].dispatched));
+        json_object_object_add(laneJ, "promoted", json_object_new_int64(stats.lanes[i].promoted));
+        json_object_object_add(cmdJ, laneNames[i], laneJ);
+    }
+    return cmdJ;
+}
+
+STATIC json_object *ServiceStatsToJson(ServiceData_t *service) {
+    json_object *serviceJ = json_object_new_object();
+
+    json_object_object_add(serviceJ, "requested", json_object_new_int64(atomic_load(&service->requested)));
+    json_object_object_add(serviceJ, "executed", json_object_new_int64(service->executed));
+    return serviceJ;
+}
+
+STATIC json_object *AmsRxStatsToJson(AmsRxData_t *amsRx) {
+    json_object *amsJ = json_object_new_object();
+
+    json_object_object_add(amsJ, "received", json_object_new_int64(amsRx->received));
+    json_object_object_add(amsJ, "batches", json_object_new_int64(amsRx->batches));
+    json_object_object_add(amsJ, "max_batch", json_object_new_int64(amsRx->maxBatch));
+    json_object_object_add(amsJ, "dropped", json_object_new_int64(amsRx->dropped));
+    json_object_object_add(amsJ, "unrouted", json_object_new_int64(atomic_load(&amsRx->unrouted)));
+    return amsJ;
+}
+
+/** Snapshot of runtime counters, taken where UCSI_Data_t lives and replied on mainloop */
+typedef struct {
+    struct afb_req request;
+    json_object *responseJ;
+} StatsJob_t;
+
+STATIC void StatsReplyJob(void *closure) {
+    StatsJob_t *job = (StatsJob_t*) closure;
+
+    afb_req_success(job->request, job->responseJ, NULL);
+    afb_req_unref(job->request);
+    free(job);
+}
+
+STATIC void StatsJob(void *closure) {
+    StatsJob_t *job = (StatsJob_t*) closure;
+    ucsContextT *ucsContext = ucsContextS;
+
+    job->responseJ = json_object_new_object();
+    json_object_object_add(job->responseJ, "rx", RxStatsToJson(&ucsContext->ucsiData));
+    json_object_object_add(job->responseJ, "tx", TxStatsToJson(&ucsContext->txQueue));
+    json_object_object_add(job->responseJ, "service", ServiceStatsToJson(&ucsContext->service));
+    json_object_object_add(job->responseJ, "commands", CmdStatsToJson(&ucsContext->ucsiData));
+    json_object_object_add(job->responseJ, "ams_rx", AmsRxStatsToJson(&ucsContext->amsRx));
+
+    if (!RunOnMainLoop(ucsContext, StatsReplyJob, job))
+        AFB_WARNING ("stats: reply lost");
+}
+
+/* return runtime counters of the control channel */
+PUBLIC void ucs2_stats (struct afb_req request) {
+    StatsJob_t *job;
+
+    /* check UNICENS is initialised */
+    if (!ucsContextS) {
+        afb_req_fail_f(request, "unicens-init","Should Load Config before using stats");
+        goto OnErrorExit;
+    }
+
+    job = calloc(1, sizeof(StatsJob_t));
+    if (!job) {
+        afb_req_fail_f(request, "stats-alloc","Cannot allocate stats request");
+        goto OnErrorExit;
+    }
+    job->request = request;
+    afb_req_addref(request);
+
+    if (!RunOnServiceLoop(ucsContextS, StatsJob, job)) {
+        afb_req_fail_f(request, "stats-alloc","Cannot allocate stats request");
+        afb_req_unref(request);
+        free(job);
+    }
+
+ OnErrorExit:
+    return;
+}
+
+STATIC json_object *LatencyHistoToJson(const UCSI_LatencyHisto_t *histo) {
+    json_object *histoJ = json_object_new_object();
+    json_object *bucketsJ = json_object_new_array();
+    int i;
+
+    json_object_object_add(histoJ, "count", json_object_new_int64(histo->count));
+    json_object_object_add(histoJ, "avg_us", json_object_new_int64(histo->count ? histo->totalUs / histo->count : 0));
+    json_object_object_add(histoJ, "max_us", json_object_new_int64(histo->maxUs));
+    for (i = 0; i < LATENCY_HISTO_LEN; i++)
+        json_object_array_add(bucketsJ, json_object_new_int64(histo->histo[i]));
+    json_object_object_add(histoJ, "log2_us", bucketsJ);
+    return histoJ;
+}
+
+/** Latency snapshot, taken where UCSI_Data_t lives and replied on mainloop */
+typedef struct {
+    struct afb_req request;
+    bool reset;
+    json_object *responseJ;
+} LatencyJob_t;
+
+STATIC void LatencyReplyJob(void *closure) {
+    LatencyJob_t *job = (LatencyJob_t*) closure;
+
+    afb_req_success(job->request, job->responseJ, NULL);
+    afb_req_unref(job->request);
+    free(job);
+}
+
+STATIC void LatencyJob(void *closure) {
+    static const char *cmdNames[UNICENS_CMD_COUNT] = {
+        "unknown", "init", "stop", "set_route", "ns_run", "gpio_create", "gpio_write", "i2c_write"
+    };
+    LatencyJob_t *job = (LatencyJob_t*) closure;
+    ucsContextT *ucsContext = ucsContextS;
+    UCSI_CmdLatency_t latency[UNICENS_CMD_COUNT];
+    json_object *cmdJ;
+    int i;
+
+    UCSI_GetCmdLatency(&ucsContext->ucsiData, latency, job->reset);
+    job->responseJ = json_object_new_object();
+    for (i = UnicensCmd_Init; i < UNICENS_CMD_COUNT; i++) {
+        cmdJ = json_object_new_object();
+        json_object_object_add(cmdJ, "wait", LatencyHistoToJson(&latency[i].wait));
+        json_object_object_add(cmdJ, "exec", LatencyHistoToJson(&latency[i].exec));
+        json_object_object_add(job->responseJ, cmdNames[i], cmdJ);
+    }
+
+    if (!RunOnMainLoop(ucsContext, LatencyReplyJob, job))
+        AFB_WARNING ("latency: reply lost");
+}
+
+/* return queue wait and execution time histograms per command type */
+PUBLIC void ucs2_latency (struct afb_req request) {
+    LatencyJob_t *job;
+    const char *reset;
+
+    /* check UNICENS is initialised */
+    if (!ucsContextS) {
+        afb_req_fail_f(request, "unicens-init","Should Load Config before using latency");
+        goto OnErrorExit;
+    }
+
+    job = calloc(1, sizeof(LatencyJob_t));
+    if (!job) {
+        afb_req_fail_f(request, "latency-alloc","Cannot allocate latency request");
+        goto OnErrorExit;
+    }
+    reset = afb_req_value(request, "reset");
+    job->reset = (reset && (!strcasecmp(reset, "true") || !strcmp(reset, "1")));
+    job->request = request;
+    afb_req_addref(request);
+
+    if (!RunOnServiceLoop(ucsContextS, LatencyJob, job)) {
+        afb_req_fail_f(request, "latency-alloc","Cannot allocate latency request");
+        afb_req_unref(request);
+        free(job);
+    }
+
+ OnErrorExit:
+    return;
+}
+
+STATIC json_object *NodeStateToJson(const UCSI_NodeState_t *state) {
+    static const char *scriptStates[] = { "none", "pending", "succeeded", "failed" };
+    json_object *nodeJ = json_object_new_object();
+
+    json_object_object_add(nodeJ, "node", json_object_new_int(state->nodeAddress));
+    json_object_object_add(nodeJ, "configured", json_object_new_boolean(NULL != state->node));
+    json_object_object_add(nodeJ, "available", json_object_new_boolean(state->available));
+    json_object_object_add(nodeJ, "available_count", json_object_new_int(state->availableCnt));
+    json_object_object_add(nodeJ, "script", json_object_new_string(
+        state->scriptState <= UCSI_ScriptState_Failed ? scriptStates[state->scriptState] : "unknown"));
+    json_object_object_add(nodeJ, "gpio_eager", json_object_new_boolean(state->gpioEager));
+    json_object_object_add(nodeJ, "gpio_port", json_object_new_int(state->gpioPortHandle));
+    json_object_object_add(nodeJ, "gpio_levels", json_object_new_int(state->gpioLevels));
+    json_object_object_add(nodeJ, "i2c_port", json_object_new_int(state->i2cPortHandle));
+    json_object_object_add(nodeJ, "script_fingerprint", json_object_new_int64(state->scriptFingerprint));
+    json_object_object_add(nodeJ, "script_duration_ms", json_object_new_int64(state->scriptDurationMs));
+    return nodeJ;
+}
+
+/** Node table lookup, done where UCSI_Data_t lives and replied on mainloop */
+typedef struct {
+    struct afb_req request;
+    bool single;
+    uint16_t nodeAddr;
+    json_object *responseJ;
+} NodesJob_t;
+
+STATIC void NodesReplyJob(void *closure) {
+    NodesJob_t *job = (NodesJob_t*) closure;
+
+    if (job->responseJ)
+        afb_req_success(job->request, job->responseJ, NULL);
+    else
+        afb_req_fail_f(job->request, "node-unknown", "node=0x%X is neither configured nor reported", job->nodeAddr);
+    afb_req_unref(job->request);
+    free(job);
+}
+
+STATIC void NodesJob(void *closure) {
+    NodesJob_t *job = (NodesJob_t*) closure;
+    ucsContextT *ucsContext = ucsContextS;
+    UCSI_NodeState_t states[UCS_NUM_REMOTE_DEVICES];
+    uint8_t cnt, i;
+
+    if (job->single) {
+        if (UCSI_GetNodeState(&ucsContext->ucsiData, job->nodeAddr, &states[0]))
+            job->responseJ = NodeStateToJson(&states[0]);
+    } else {
+        job->responseJ = json_object_new_array();
+        cnt = UCSI_GetNodeStates(&ucsContext->ucsiData, states, UCS_NUM_REMOTE_DEVICES);
+        for (i = 0; i < cnt; i++)
+            json_object_array_add(job->responseJ, NodeStateToJson(&states[i]));
+    }
+
+    if (!RunOnMainLoop(ucsContext, NodesReplyJob, job))
+        AFB_WARNING ("nodes: reply lost");
+}
+
+/* return the runtime state of one or all nodes, answered from the node table */
+PUBLIC void ucs2_nodes (struct afb_req request) {
+    NodesJob_t *job;
+    const char *node;
+    uint16_t nodeAddr = 0;
+
+    /* check UNICENS is initialised */
+    if (!ucsContextS) {
+        afb_req_fail_f(request, "unicens-init","Should Load Config before using nodes");
+        goto OnErrorExit;
+    }
+
+    node = afb_req_value(request, "node");
+    if (node && !ParseUint16(node, &nodeAddr)) {
+        afb_req_fail_f(request, "nodes-node","Invalid node=%s, must be within 0..0xFFFF", node);
+        goto OnErrorExit;
+    }
+
+    job = calloc(1, sizeof(NodesJob_t));
+    if (!job) {
+        afb_req_fail_f(request, "nodes-alloc","Cannot allocate nodes request");
+        goto OnErrorExit;
+    }
+    if (node) {
+        job->single = true;
+        job->nodeAddr = nodeAddr;
+    }
+    job->request = request;
+    afb_req_addref(request);
+
+    if (!RunOnServiceLoop(ucsContextS, NodesJob, job)) {
+        afb_req_fail_f(request, "nodes-alloc","Cannot allocate nodes request");
+        afb_req_unref(request);
+        free(job);
+    }
+
+ OnErrorExit:
+    return;
+}
+
+STATIC json_object *TraceRecordToJson(const UcsTrace_Record_t *rec, bool raw) {
+    char text[300];
+    json_object *recJ = json_object_new_object();
+    json_object *argsJ;
+    int i;
+
+    json_object_object_add(recJ, "seq", json_object_new_int64(rec->seq));
+    json_object_object_add(recJ, "time_us", json_object_new_int64((int64_t)rec->timeUs));
+    json_object_object_add(recJ, "node", json_object_new_int(rec->nodeAddress));
+    if (raw) {
+        /* for offline decoding, the strings are static and can be resolved here */
+        json_object_object_add(recJ, "event", json_object_new_int(rec->event));
+        json_object_object_add(recJ, "label", json_object_new_string(rec->label ? rec->label : ""));
+        json_object_object_add(recJ, "format", json_object_new_string(rec->format ? rec->format : ""));
+        argsJ = json_object_new_array();
+        for (i = 0; i < rec->argCnt; i++)
+            json_object_array_add(argsJ, json_object_new_int64(rec->args[i]));
+        json_object_object_add(recJ, "args", argsJ);
+    } else {
+        UcsTrace_Format(rec, text, sizeof(text));
+        json_object_object_add(recJ, "text", json_object_new_string(text));
+    }
+    return recJ;
+}
+
+/* return trace records, the ring is lock free so no hop to the service loop is needed */
+PUBLIC void ucs2_trace (struct afb_req request) {
+    UcsTrace_Record_t *records;
+    json_object *responseJ, *recordsJ;
+    const char *value;
+    uint32_t since, lost;
+    uint16_t cnt, max, i;
+    bool raw;
+
+    /* check UNICENS is initialised */
+    if (!ucsContextS) {
+        afb_req_fail_f(request, "unicens-init","Should Load Config before using trace");
+        goto OnErrorExit;
+    }
+
+    since = 0;
+    value = afb_req_value(request, "since");
+    if (value && !ParseUint32(value, &since)) {
+        afb_req_fail_f(request, "trace-since","Invalid since=%s, must be a 32 bit sequence number", value);
+        goto OnErrorExit;
+    }
+    max = UCS_TRACE_LEN;
+    value = afb_req_value(request, "max");
+    if (value && (!ParseUint16(value, &max) || 0 == max || max > UCS_TRACE_LEN)) {
+        afb_req_fail_f(request, "trace-max","Invalid max=%s, must be within 1..%d", value, UCS_TRACE_LEN);
+        goto OnErrorExit;
+    }
+    value = afb_req_value(request, "raw");
+    raw = (value && (!strcasecmp(value, "true") || !strcmp(value, "1")));
+
+    records = calloc(max, sizeof(UcsTrace_Record_t));
+    if (!records) {
+        afb_req_fail_f(request, "trace-alloc","Cannot allocate trace request");
+        goto OnErrorExit;
+    }
+    cnt = UCSI_ReadTrace(&ucsContextS->ucsiData, &since, records, max, &lost);
+
+    recordsJ = json_object_new_array();
+    for (i = 0; i < cnt; i++)
+        json_object_array_add(recordsJ, TraceRecordToJson(&records[i], raw));
+    free(records);
+
+    responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "next", json_object_new_int64(since));
+    json_object_object_add(responseJ, "lost", json_object_new_int64(lost));
+    json_object_object_add(responseJ, "records", recordsJ);
+    afb_req_success(request, responseJ, NULL);
+
+ OnErrorExit:
+    return;
+}
+
+/** I2C write in flight, holds a reference on the request until replied on mainloop */
+typedef struct {
+    struct afb_req request;
+    uint16_t nodeAddr;
+    uint8_t dataLen;
+    uint8_t data[I2C_MAX_DATA_SZ];
+    bool queued;
+    bool hasResult;
+    Ucs_I2c_ResultCode_t result;
+} I2cWriteJob_t;
+
+STATIC void I2cWriteReplyJob(void *closure) {
+    I2cWriteJob_t *job = (I2cWriteJob_t*) closure;
+
+    if (!job->queued) {
+        AFB_NOTICE("i2c write: scheduling command failed");
+        afb_req_fail_f(job->request, "query-command-queue","command queue overload");
+    }
+    else if (!job->hasResult) {
+        afb_req_fail(job->request, "processing","busy or lost initialization");
+    }
+    else if (job->result != UCS_I2C_RES_SUCCESS){
+        afb_req_fail_f(job->request, "error-result", "result code: %d", job->result);
+    }
+    else {
+        afb_req_success(job->request, NULL, "success");
+    }
+
+    afb_req_unref(job->request);
+    free(job);
+}
+
 STATIC void ucs2_writei2c_CB (void *result_ptr, void *request_ptr) {
     
     if (request_ptr){
-        afb_req *req = (afb_req *)request_ptr;
+        I2cWriteJob_t *job = (I2cWriteJob_t *)request_ptr;
         Ucs_I2c_ResultCode_t *res = (Ucs_I2c_ResultCode_t *)result_ptr;
         
-        if (!res) {
-            afb_req_fail(*req, "processing","busy or lost initialization");
-        }
-        else if (*res != UCS_I2C_RES_SUCCESS){
-            afb_req_fail_f(*req, "error-result", "result code: %d", *res);
-        }
-        else {
-            afb_req_success(*req, NULL, "success");
-        }
-        
-        afb_req_unref(*req);
-        free(request_ptr);
+        job->hasResult = (NULL != res);
+        if (res)
+            job->result = *res;
+
+        if (!RunOnMainLoop(ucsContextS, I2cWriteReplyJob, job))
+            AFB_WARNING("write_i2c: reply lost");
     } 
     else {
         AFB_NOTICE("write_i2c: ambiguous response data");
     }
 }
 
+/* UCSI command submission is thread-safe, called straight from verb context */
+STATIC void I2cWriteSubmit(I2cWriteJob_t *job) {
+
+    /* set before submission, the result may be replied by the I/O thread before UCSI_I2CWrite returns */
+    job->queued = true;
+    if (!UCSI_I2CWrite(  &ucsContextS->ucsiData,   /* UCSI_Data_t *pPriv*/
+                        job->nodeAddr,            /* uint16_t targetAddress*/
+                        false,                    /* bool isBurst*/
+                        0u,                       /* block count */
+                        0x2Au,                    /* i2c slave address */
+                        0x03E8u,                  /* timeout 1000 milliseconds */
+                        job->dataLen,             /* uint8_t dataLen */
+                        &job->data[0],            /* uint8_t *pData */
+                        &ucs2_writei2c_CB,        /* callback*/
+                        (void*)job                /* callback argument */
+                  )) {
+        /* command queue full, reply straight away */
+        job->queued = false;
+        if (!RunOnMainLoop(ucsContextS, I2cWriteReplyJob, job))
+            AFB_WARNING("write_i2c: reply lost");
+    }
+}
+
 /* write a single i2c command */
 STATIC void ucs2_writei2c_cmd(struct afb_req request, json_object *j_obj) {
     
-    static uint8_t i2c_data[I2C_MAX_DATA_SZ];
+    uint8_t i2c_data[I2C_MAX_DATA_SZ];
     uint8_t i2c_data_sz = 0;
     uint16_t node_addr = 0;
-    struct afb_req *async_req_ptr = NULL;
-    
+    I2cWriteJob_t *job = NULL;
     node_addr = (uint16_t)json_object_get_int(json_object_object_get(j_obj, "node"));
     AFB_NOTICE("node_address: 0x%02X", node_addr);
     
@@ -532,30 +1734,18 @@ STATIC void ucs2_writei2c_cmd(struct afb_req request, json_object *j_obj) {
         goto OnErrorExit;
     }
    
-    async_req_ptr = malloc(sizeof(afb_req));
-    *async_req_ptr = request;
-    
-    if (UCSI_I2CWrite(  &ucsContextS->ucsiData,   /* UCSI_Data_t *pPriv*/
-                        node_addr,                /* uint16_t targetAddress*/
-                        false,                    /* bool isBurst*/
-                        0u,                       /* block count */
-                        0x2Au,                    /* i2c slave address */
-                        0x03E8u,                  /* timeout 1000 milliseconds */
-                        i2c_data_sz,              /* uint8_t dataLen */
-                        &i2c_data[0],             /* uint8_t *pData */
-                        &ucs2_writei2c_CB,        /* callback*/
-                        (void*)async_req_ptr      /* callback argument */
-                  )) {
-        /* asynchronous command is running */
-        afb_req_addref(request);
-    }
-    else {
-        AFB_NOTICE("i2c write: scheduling command failed");
+    job = calloc(1, sizeof(I2cWriteJob_t));
+    if (!job) {
         afb_req_fail_f(request, "query-command-queue","command queue overload");
-        free(async_req_ptr);
-        async_req_ptr = NULL;
         goto OnErrorExit;
     }
+    job->request = request;
+    job->nodeAddr = node_addr;
+    job->dataLen = i2c_data_sz;
+    memcpy(job->data, i2c_data, i2c_data_sz);
+    afb_req_addref(request);
+
+    I2cWriteSubmit(job);
     
 OnErrorExit:
     return;
@@ -46,6 +46,10 @@ extern struct afb_service afbSrv;
 PUBLIC void ucs2_configure (struct afb_req request);
 PUBLIC void ucs2_subscribe (struct afb_req request);
 PUBLIC void ucs2_writei2c  (struct afb_req request);
+PUBLIC void ucs2_stats     (struct afb_req request);
+PUBLIC void ucs2_nodes     (struct afb_req request);
+PUBLIC void ucs2_latency   (struct afb_req request);
+PUBLIC void ucs2_trace     (struct afb_req request);
 
 #endif /* UCS2BINDING_H */
 
@@ -58,6 +58,7 @@ struct UcsXmlScript
     bool inUse;
     char scriptName[32];
     Ucs_Rm_Node_t *node;
+    bool *nodeGpio;
     struct UcsXmlScript *next;
 };
 
@@ -87,6 +88,7 @@ typedef enum
 typedef struct
 {
     Ucs_Rm_Node_t *nod;
+    bool *gpio;
     Ucs_Xrm_UsbPort_t *usbPort;
     Ucs_Xrm_MlbPort_t *mlbPort;
     Ucs_Xrm_StrmPort_t *strmPortA;
@@ -146,6 +148,7 @@ static const char* OFFSET =                 "Offset";
 static const char* NODE =                   "Node";
 static const char* CLOCK_CONFIG =           "ClockConfig";
 static const char* ADDRESS =                "Address";
+static const char* GPIO_PORT =              "GpioPort";
 static const char* FRAMES_PER_TRANSACTION = "FramesPerTransaction";
 static const char* MUTE_MODE =              "MuteMode";
 static const char* MUTE_MODE_NO_MUTING =    "NoMuting";
@@ -714,6 +717,8 @@ static ParseResult_t ParseAll(xmlNode *tree, UcsXmlVal_t *ucs, PrivateData_t *pr
 
     ucs->pNod = MCalloc(&priv->objList, nodeCount, sizeof(Ucs_Rm_Node_t));
     if (NULL == ucs->pNod) RETURN_ASSERT(Parse_MemoryError);
+    ucs->pNodGpio = MCalloc(&priv->objList, nodeCount, sizeof(bool));
+    if (NULL == ucs->pNodGpio) RETURN_ASSERT(Parse_MemoryError);
 
     if (!GetUInt16(tree, PACKET_BW, &ucs->packetBw, true))
         RETURN_ASSERT(Parse_XmlError);
@@ -727,6 +732,7 @@ static ParseResult_t ParseAll(xmlNode *tree, UcsXmlVal_t *ucs, PrivateData_t *pr
         xmlNode *con;
         memset(&priv->nodeData, 0, sizeof(NodeData_t));
         priv->nodeData.nod = &ucs->pNod[ucs->nodSize];
+        priv->nodeData.gpio = &ucs->pNodGpio[ucs->nodSize];
         if (Parse_Success != (result = ParseNode(sub, priv)))
             return result;
         /*/Iterate all connections. Node without any connection is also valid.*/
@@ -805,11 +811,19 @@ static ParseResult_t ParseNode(xmlNode *node, PrivateData_t *priv)
     if(NULL == signature) RETURN_ASSERT(Parse_MemoryError);
     if (!GetUInt16(node, ADDRESS, &signature->node_address, true))
         RETURN_ASSERT(Parse_XmlError);
+    if (GetString(node, GPIO_PORT, &txt, false))
+    {
+        if (0 == strcmp(txt, VALUE_TRUE) || 0 == strcmp(txt, VALUE_1))
+            *priv->nodeData.gpio = true;
+        else if (0 != strcmp(txt, VALUE_FALSE) && 0 != strcmp(txt, VALUE_0))
+            RETURN_ASSERT(Parse_XmlError);
+    }
     if (GetString(node, SCRIPT, &txt, false))
     {
         struct UcsXmlScript *scr = MCalloc(&priv->objList, 1, sizeof(struct UcsXmlScript));
         if (NULL == scr) RETURN_ASSERT(Parse_MemoryError);
         scr->node = priv->nodeData.nod;
+        scr->nodeGpio = priv->nodeData.gpio;
         strncpy(scr->scriptName, txt, sizeof(scr->scriptName));
         AddScript(&priv->pScrLst, scr);
     }
@@ -1145,7 +1159,8 @@ static ParseResult_t ParseSocket(xmlNode *soc, bool isSource, MSocketType_t sock
         route->routeId = priv->conData.routeId;
         route->ep = ep;
         assert(NULL != priv->conData.routeName);
-        strncpy(route->routeName, priv->conData.routeName, sizeof(route->routeName));
+        /* keep the name terminated, it is handed out by pRouteNames */
+        strncpy(route->routeName, priv->conData.routeName, sizeof(route->routeName) - 1);
         AddRoute(&priv->pRtLst, route);
     }
     return Parse_Success;
@@ -1154,6 +1169,7 @@ static ParseResult_t ParseSocket(xmlNode *soc, bool isSource, MSocketType_t sock
 static ParseResult_t ParseScript(xmlNode *scr, PrivateData_t *priv)
 {
     bool found = false;
+    bool usesGpio = false;
     xmlNode *act;
     uint32_t actCnt;
     uint32_t i = 0;
@@ -1178,14 +1194,17 @@ static ParseResult_t ParseScript(xmlNode *scr, PrivateData_t *priv)
         } else if (0 == strcmp(txt, SCRIPT_GPIO_PORT_CREATE)) {
             ParseResult_t result = ParseScriptGpioPortCreate(act, &script[i], priv);
             if (Parse_Success != result) return result;
+            usesGpio = true;
             ++actCnt;
         } else if (0 == strcmp(txt, SCRIPT_GPIO_PORT_PIN_MODE)) {
             ParseResult_t result = ParseScriptGpioPinMode(act, &script[i], priv);
             if (Parse_Success != result) return result;
+            usesGpio = true;
             ++actCnt;
         } else if (0 == strcmp(txt, SCRIPT_GPIO_PIN_STATE)) {
             ParseResult_t result = ParseScriptGpioPinState(act, &script[i], priv);
             if (Parse_Success != result) return result;
+            usesGpio = true;
             ++actCnt;
         } else if (0 == strcmp(txt, SCRIPT_I2C_PORT_CREATE)) {
             ParseResult_t result = ParseScriptPortCreate(act, &script[i], priv);
@@ -1219,6 +1238,8 @@ static ParseResult_t ParseScript(xmlNode *scr, PrivateData_t *priv)
             Ucs_Rm_Node_t *node = scrlist->node;
             node->script_list_ptr = script;
             node->script_list_size = actCnt;
+            if (usesGpio)
+                *scrlist->nodeGpio = true;
             scrlist->inUse = true;
             found = true;
         }
@@ -1545,6 +1566,8 @@ static ParseResult_t ParseRoutes(UcsXmlVal_t *ucs, PrivateData_t *priv)
         return Parse_Success; /*Its okay to have no routes at all (e.g. MEP traffic only)*/
     ucs->pRoutes = MCalloc(&priv->objList, routeAmount, sizeof(Ucs_Rm_Route_t));
     if (NULL == ucs->pRoutes) RETURN_ASSERT(Parse_MemoryError);
+    ucs->pRouteNames = MCalloc(&priv->objList, routeAmount, sizeof(char *));
+    if (NULL == ucs->pRouteNames) RETURN_ASSERT(Parse_MemoryError);
 
     /*Second: Fill allocated structure now*/
     sourceRoute = priv->pRtLst;
@@ -1559,7 +1582,8 @@ static ParseResult_t ParseRoutes(UcsXmlVal_t *ucs, PrivateData_t *priv)
                     && !sinkRoute->isSource
                     && (0 == strncmp(sourceRoute->routeName, sinkRoute->routeName, sizeof(sourceRoute->routeName))))
                 {
-                    Ucs_Rm_Route_t *route = &ucs->pRoutes[ucs->routesSize++];
+                    Ucs_Rm_Route_t *route = &ucs->pRoutes[ucs->routesSize];
+                    ucs->pRouteNames[ucs->routesSize++] = sinkRoute->routeName;
                     route->source_endpoint_ptr = sourceRoute->ep;
                     route->sink_endpoint_ptr = sinkRoute->ep;
                     route->active = sinkRoute->isActive;
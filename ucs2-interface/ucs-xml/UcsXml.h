@@ -49,10 +49,15 @@ typedef struct
     Ucs_Rm_Route_t *pRoutes;
     /** Route array size */
     uint16_t routesSize;
+    /** Names of the routes, same index and size as pRoutes. All sinks of one source share the name. */
+    const char **pRouteNames;
     /** Array of nodes */
     Ucs_Rm_Node_t *pNod;
     /** Node array size */
     uint16_t nodSize;
+    /** Same index and size as pNod. true, if the node uses GPIO, either
+     *  declared by the GpioPort attribute or by GPIO actions in its script. */
+    bool *pNodGpio;
     /** Internal data, to be ignored */
     void *pInternal;
 } UcsXmlVal_t;
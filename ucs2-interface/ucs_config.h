@@ -36,16 +36,37 @@
 
 #define ENABLE_INIC_WATCHDOG    (true)
 #define ENABLE_AMS_LIB          (true)
+#define ENABLE_WARM_RESTART     (true) /* keep routes and node scripts across UNICENS restarts */
 #define DEBUG_XRM
-#define BOARD_PMS_TX_SIZE       (72)
-#define CMD_QUEUE_LEN           (40)
+#define TX_MAX_SEGMENTS         (8)
+#define CMD_QUEUE_LEN           (40)  /* default initial capacity of the command pool */
+#define CMD_QUEUE_MAX_LEN       (160) /* default growth limit of the command pool */
+#define CMD_QUEUE_GROW_LEN      (20)  /* commands added per growth step */
+#define CMD_MAX_NODES           (64)  /* distinct destinations tracked per dispatch run */
+#define CMD_INGRESS_LEN         (32) /* must be a power of two */
+#define CMD_MAX_IN_FLIGHT       (8)
+#define CMD_MAX_SCRIPTS         (4)   /* default limit of node scripts running in parallel */
+#define CMD_STARVATION_MS       (500) /* waiting longer lets a lane overtake higher priorities */
+#define CMD_DEADLINE_MS         (3000)  /* in flight commands without result are given up after this time */
+#define CMD_INIT_DEADLINE_MS    (15000) /* same for Init and Stop, which wait for the network */
+#define CMD_SCRIPT_STEP_MS      (1000)  /* node scripts get this per step on top of CMD_DEADLINE_MS and their pauses */
+#define GPIO_DEBOUNCE_MS        (20)  /* debounce time of remote GPIO ports */
 #define I2C_WRITE_MAX_LEN       (32)
+#define I2C_BURST_WINDOW_MS     (5)   /* writes to one node are collected that long into a burst, 0 disables */
+#define I2C_BURST_MAX_BLOCKS    (30)  /* limit of UNICENS burst mode */
+#define ROUTE_NAME_MAX_LEN      (32)  /* including termination, as given by the XML parser */
+#define NODE_HASH_LEN           (128) /* slots of the node address hash, power of two above 2 * UCS_NUM_REMOTE_DEVICES */
+#define RX_BATCH_HISTO_LEN      (8)
+#define LATENCY_HISTO_LEN       (24)  /* log2 buckets of microseconds, the last one collects everything above */
 
 #include <string.h>
 #include <stdarg.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
 
 #include "ucs_cfg.h"
 #include "ucs_api.h"
+#include "ucs_trace.h"
 
 /*>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>*/
 /*                          PRIVATE SECTION                             */
@@ -61,7 +82,9 @@ typedef enum
     /**Result is OK but the processing is ongoing. Must wait for callback.*/
     UniCmdResult_OK_NeedToWaitForCB,
     /**Result is error and the processing is finished. Safe to dequeue this command.*/
-    UniCmdResult_ERROR_ProcessFinished
+    UniCmdResult_ERROR_ProcessFinished,
+    /**UNICENS API is locked by an ongoing request. Keep command queued and try again.*/
+    UniCmdResult_Retry
 } UnicensCmdResult_t;
 
 /**
@@ -87,6 +110,8 @@ typedef enum
     UnicensCmd_I2CWrite
 } UnicensCmd_t;
 
+#define UNICENS_CMD_COUNT       (UnicensCmd_I2CWrite + 1)
+
 /**
  * \brief Internal struct for UNICENS Integration
  */
@@ -100,7 +125,9 @@ typedef struct
  */
 typedef struct
 {
-    Ucs_Rm_Route_t *routePtr;
+    uint16_t routeId;
+    /** If not empty, all routes of this name are switched and routeId is ignored */
+    char routeName[ROUTE_NAME_MAX_LEN];
     bool isActive;
 } UnicensCmdRmSetRoute_t;
 
@@ -164,21 +191,355 @@ typedef struct
         UnicensCmdGpioWritePort_t GpioWritePort;
         UnicensCmdI2CWrite_t I2CWrite;
     } val;
+    /** Time the command was handed to the integration layer, for latency statistics */
+    uint64_t submittedUs;
 } UnicensCmdEntry_t;
 
 /**
- * \brief Internal variables for one instance of UNICENS Integration
- * \note Never touch any of this fields!
+ * \brief Priority classes of the command queue, highest priority first
+ */
+typedef enum
+{
+    /** Init and Stop, executed alone */
+    UCSI_Lane_Lifecycle,
+    /** Route activation and deactivation */
+    UCSI_Lane_Routing,
+    /** GPIO port creation and writes */
+    UCSI_Lane_Gpio,
+    /** Remote I2C writes and node scripts */
+    UCSI_Lane_Bulk,
+    UCSI_LANE_COUNT
+} UCSI_Lane_t;
+
+/**
+ * \brief Open addressing index of the configured routes, built by UCSI_NewConfig
+ */
+typedef struct
+{
+    Ucs_Rm_Route_t *routes;
+    const char **names;
+    uint16_t count;
+    /** Amount of slots per table, power of two */
+    uint32_t size;
+    /** Slots hold the route index + 1, 0 marks a free slot */
+    uint16_t *byId;
+    /** Slots hold the index + 1 of the first route with this name */
+    uint16_t *byName;
+    /** Per route, index + 1 of the next route with the same name, 0 ends the chain */
+    uint16_t *nameNext;
+} UCSI_RouteIndex_t;
+
+/**
+ * \brief Progress of the node scripts, see UCSI_NodeState_t
+ */
+typedef enum
+{
+    /** The node has no scripts or was not seen yet */
+    UCSI_ScriptState_None,
+    /** Scripts are queued or running */
+    UCSI_ScriptState_Pending,
+    UCSI_ScriptState_Succeeded,
+    UCSI_ScriptState_Failed
+} UCSI_ScriptState_t;
+
+/**
+ * \brief What happens to the scripts of a node, which becomes available again
+ */
+typedef enum
+{
+    /** The scripts are executed every time */
+    UCSI_ScriptPolicy_Always,
+    /** The scripts are skipped, if they succeeded before and did not change since.
+     *  Only suitable, if the nodes keep their settings while being unavailable. */
+    UCSI_ScriptPolicy_SkipUnchanged
+} UCSI_ScriptPolicy_t;
+
+/**
+ * \brief Outcome of UCSI_AmsTxAllocate
+ */
+typedef enum
+{
+    /** A message was reserved */
+    UCSI_AmsTx_Ok,
+    /** All TX messages are in use, retry after UCSI_CB_OnAmsTxAvailable was raised */
+    UCSI_AmsTx_Busy,
+    /** UNICENS is not running or the payload exceeds UCS_AMS_SIZE_TX_MSG */
+    UCSI_AmsTx_Error
+} UCSI_AmsTxStatus_t;
+
+/**
+ * \brief Completion context of a reserved AMS TX message, referenced by custom_info_ptr
+ */
+typedef struct UCSI_AmsTxCtx
+{
+    Ucsi_ResultCb_t result_fptr;
+    void *request_ptr;
+    struct UCSI_AmsTxCtx *next;
+} UCSI_AmsTxCtx_t;
+
+/**
+ * \brief Runtime state of one node, kept up to date by the UNICENS callbacks
+ */
+typedef struct
+{
+    uint16_t nodeAddress;
+    /** true, if the manager reported the node as available */
+    bool available;
+    /** see UCSI_ScriptState_t */
+    uint8_t scriptState;
+    /** true, if the GPIO port is created once the node is available. Otherwise
+     *  the first GPIO write to the node creates it. */
+    bool gpioEager;
+    /** Handle of the remote GPIO port, 0 until created */
+    uint16_t gpioPortHandle;
+    /** Last pin levels reported by a GPIO trigger event */
+    uint16_t gpioLevels;
+    /** Handle of the remote I2C port, 0 until the first write finished */
+    uint16_t i2cPortHandle;
+    /** Hash over signature and scripts, which last succeeded. 0 if none did */
+    uint32_t scriptFingerprint;
+    /** Time the last script run took to complete */
+    uint32_t scriptDurationMs;
+    /** Amount of times the node became available */
+    uint16_t availableCnt;
+    /** Node of the current configuration, NULL if the address is not configured */
+    Ucs_Rm_Node_t *node;
+} UCSI_NodeState_t;
+
+/**
+ * \brief Per node state table, found by node address through an open addressing hash
+ */
+typedef struct
+{
+    UCSI_NodeState_t nodes[UCS_NUM_REMOTE_DEVICES];
+    uint8_t count;
+    /** Hash slots of the node addresses, index + 1 into nodes, 0 if the slot is free */
+    uint8_t byAddress[NODE_HASH_LEN];
+} UCSI_NodeTable_t;
+
+/**
+ * \brief Queued command of UNICENS Integration, either waiting or in flight
+ */
+typedef struct UCSI_Cmd
+{
+    UnicensCmdEntry_t e;
+    /** true, if UNICENS accepted the command and its result callback is pending */
+    bool inFlight;
+    /** Time the command was queued, used for starvation protection */
+    uint64_t enqueuedUs;
+    /** Time UNICENS accepted the command */
+    uint64_t dispatchedUs;
+    /** The command is given up, if UNICENS did not report its result until then */
+    uint64_t deadlineUs;
+    struct UCSI_Cmd *next;
+    /** I2C writes folded into this burst, they are no longer queued and get the result of this command */
+    struct UCSI_Cmd *burstNext;
+} UCSI_Cmd_t;
+
+/**
+ * \brief Commands of one priority class, in enqueue order
+ */
+typedef struct
+{
+    UCSI_Cmd_t *head;
+    UCSI_Cmd_t *tail;
+} UCSI_CmdList_t;
+
+/**
+ * \brief Statistics of one priority class, see UCSI_GetCmdStats
+ */
+typedef struct
+{
+    /** Amount of commands currently queued (waiting and in flight) */
+    uint16_t depth;
+    /** Biggest depth seen since UCSI_Init */
+    uint16_t maxDepth;
+    /** Amount of commands handed over to UNICENS */
+    uint32_t dispatched;
+    /** Amount of dispatch runs this lane was served before higher priorities, because it was starving */
+    uint32_t promoted;
+} UCSI_LaneStats_t;
+
+/**
+ * \brief What happens to a new command, when the command pool is full and may not grow
  */
-typedef struct {
-    volatile uint8_t *dataQueue;
-    volatile uint8_t *pRx;
-    volatile uint8_t *pTx;
-    volatile uint32_t amountOfEntries;
-    volatile uint32_t sizeOfEntry;
-    volatile uint32_t rxPos;
-    volatile uint32_t txPos;
-} RB_t;
+typedef enum
+{
+    /** The new command is refused */
+    UCSI_QueuePolicy_Reject,
+    /** The oldest waiting command of the same kind is dropped in favor of the new one */
+    UCSI_QueuePolicy_DropOldest,
+    /** The new command is merged into a waiting one with the same kind and target, if any */
+    UCSI_QueuePolicy_Coalesce
+} UCSI_QueuePolicy_t;
+
+/**
+ * \brief Sizing of the command pool, see UCSI_Init
+ */
+typedef struct
+{
+    /** Amount of commands allocated by UCSI_Init */
+    uint16_t capacity;
+    /** The pool grows in steps of CMD_QUEUE_GROW_LEN up to this amount, set to capacity to disable growth */
+    uint16_t maxCapacity;
+    /** Applied once the pool reached maxCapacity */
+    UCSI_QueuePolicy_t policy;
+    /** Amount of node scripts running in parallel, 0 selects CMD_MAX_SCRIPTS */
+    uint8_t maxScripts;
+} UCSI_CmdQueueCfg_t;
+
+/**
+ * \brief Statistics of the command pool, see UCSI_GetCmdStats
+ */
+typedef struct
+{
+    /** Amount of commands currently allocated */
+    uint16_t capacity;
+    /** Amount of commands currently queued */
+    uint16_t used;
+    /** Biggest amount of commands queued at the same time, use it to size capacity */
+    uint16_t highWater;
+    /** Amount of growth steps */
+    uint32_t grown;
+    /** Amount of commands dropped by UCSI_QueuePolicy_DropOldest */
+    uint32_t dropped;
+    /** Amount of commands merged by UCSI_QueuePolicy_Coalesce */
+    uint32_t coalesced;
+    /** Amount of GPIO writes folded into a waiting write to the same node */
+    uint32_t gpioMerged;
+    /** Amount of I2C burst transactions built from single writes */
+    uint32_t i2cBursts;
+    /** Amount of I2C writes folded into a burst of a preceding write */
+    uint32_t i2cBurstMerged;
+    /** Amount of commands refused because the pool was full */
+    uint32_t rejected;
+    /** Amount of commands refused because the ingress queue was full */
+    uint32_t ingressRejected;
+    /** Amount of in flight commands given up, because their deadline passed */
+    uint32_t expired;
+    /** Amount of results arriving after their command expired, they are ignored */
+    uint32_t lateResults;
+} UCSI_PoolStats_t;
+
+/**
+ * \brief Remembers an expired command until the next dispatch of the same command to
+ *        the same node, so a late result arriving in between is recognised
+ */
+typedef struct
+{
+    UnicensCmd_t cmd;
+    uint16_t nodeAddress;
+    /** The entry is void after this time, 0 marks a free entry */
+    uint64_t untilUs;
+} UCSI_ExpiredCmd_t;
+
+/**
+ * \brief Statistics of UNICENS restarts after errors and of nodes becoming available again
+ */
+typedef struct
+{
+    /** Amount of restarts keeping the loaded configuration */
+    uint32_t warm;
+    /** Amount of routes handed active to the restarted UNICENS */
+    uint32_t routesRestored;
+    /** Amount of node scripts not run again, because the node kept them */
+    uint32_t scriptsSkipped;
+    /** Amount of node scripts not run again, because their fingerprint did not change */
+    uint32_t scriptsUnchanged;
+} UCSI_RestartStats_t;
+
+/**
+ * \brief Statistics of the command queue, see UCSI_GetCmdStats
+ */
+typedef struct
+{
+    UCSI_PoolStats_t pool;
+    UCSI_RestartStats_t restart;
+    UCSI_LaneStats_t lanes[UCSI_LANE_COUNT];
+    /** Amount of commands waiting for their UNICENS result */
+    uint16_t inFlight;
+    /** Amount of node scripts among them */
+    uint8_t scriptsInFlight;
+} UCSI_CmdStats_t;
+
+/**
+ * \brief Latency distribution, see UCSI_GetCmdLatency
+ */
+typedef struct
+{
+    /** Amount of samples */
+    uint32_t count;
+    /** Sum of all samples, divide by count for the average */
+    uint64_t totalUs;
+    uint32_t maxUs;
+    /** Bucket 0 counts samples of 0us, bucket n (n>0) samples from 2^(n-1) to 2^n-1 us */
+    uint32_t histo[LATENCY_HISTO_LEN];
+} UCSI_LatencyHisto_t;
+
+/**
+ * \brief Latency of one command type, see UCSI_GetCmdLatency
+ */
+typedef struct
+{
+    /** From handing the command over to UCSI until UNICENS accepted it */
+    UCSI_LatencyHisto_t wait;
+    /** From UNICENS accepting the command until its result */
+    UCSI_LatencyHisto_t exec;
+} UCSI_CmdLatency_t;
+
+/**
+ * \brief One slot of the command ingress queue, see UCSI_Ingress_t
+ */
+typedef struct
+{
+    atomic_uint sequence;
+    UnicensCmdEntry_t entry;
+} UCSI_IngressCell_t;
+
+/**
+ * \brief Bounded lock-free queue, filled by any thread and drained by UCSI_Service
+ * \note Multiple producers, single consumer. Producers claim a slot with a CAS on
+ *       enqueuePos, the per slot sequence publishes the entry to the consumer.
+ */
+typedef struct
+{
+    UCSI_IngressCell_t cells[CMD_INGRESS_LEN];
+    atomic_uint enqueuePos;
+    uint32_t dequeuePos;
+    atomic_uint rejected;
+} UCSI_Ingress_t;
+
+/**
+ * \brief Statistics of the received control telegrams, see UCSI_GetRxStats
+ */
+typedef struct
+{
+    /** Amount of batches framed by UCSI_RxBatchBegin/UCSI_RxBatchEnd (one per LLD wakeup) */
+    uint32_t wakeups;
+    /** Amount of telegrams passed to UNICENS */
+    uint32_t frames;
+    /** Amount of times no LLD buffer was available for a received telegram */
+    uint32_t rejected;
+    /** Biggest amount of telegrams offered by a single wakeup */
+    uint16_t maxFramesPerWakeup;
+    /** Wakeups sorted by telegram count (index 0 = 1 telegram), last entry counts all bigger batches */
+    uint32_t framesPerWakeup[RX_BATCH_HISTO_LEN];
+} UCSI_RxStats_t;
+
+/**
+ * \brief Internal time base of UNICENS Integration, see UCSI_GetTimeUs
+ */
+typedef struct
+{
+    /** Time read once at the begin of the current service pass */
+    uint64_t cachedUs;
+    /** true, while a service pass is running and cachedUs is valid */
+    bool cacheValid;
+    /** Last millisecond tick given to UNICENS */
+    uint16_t lastTick;
+    /** Amount of times the 16 bit millisecond tick wrapped around */
+    uint32_t wraps;
+} UCSI_Time_t;
 
 /**
  * \brief Internal variables for one instance of UNICENS Integration
@@ -191,14 +552,36 @@ typedef struct
     uint32_t magic;
     void *tag;
     bool initialized;
-    RB_t rb;
-    uint8_t rbBuf[(CMD_QUEUE_LEN * sizeof(UnicensCmdEntry_t))];
+    UCSI_Ingress_t ingress;
+    UCSI_CmdQueueCfg_t cmdCfg;
+    UCSI_PoolStats_t poolStats;
+    UCSI_Cmd_t *cmdFree;
+    UCSI_CmdList_t lanes[UCSI_LANE_COUNT];
+    UCSI_LaneStats_t laneStats[UCSI_LANE_COUNT];
+    uint16_t inFlightCnt;
+    uint8_t scriptsInFlight;
+    uint64_t cmdTimerDueUs;
+    UCSI_ExpiredCmd_t expired[CMD_MAX_IN_FLIGHT];
+    uint8_t expiredPos;
+    UCSI_CmdLatency_t latency[UNICENS_CMD_COUNT];
     Ucs_Inst_t *unicens;
     Ucs_InitData_t uniInitData;
+    UCSI_RouteIndex_t routeIdx;
+    UCSI_NodeTable_t nodeTable;
+    UCSI_RestartStats_t restartStats;
+    UCSI_ScriptPolicy_t scriptPolicy;
+    UCSI_AmsTxCtx_t amsTxCtx[UCS_AMS_NUM_TX_MSGS];
+    UCSI_AmsTxCtx_t *amsTxFree;
+    bool amsTxStarved;
     bool triggerService;
+    bool rxBatchActive;
+    bool rxStarved;
+    uint16_t rxBatchFrames;
+    UCSI_RxStats_t rxStats;
+    UCSI_Time_t time;
+    UcsTrace_Ring_t trace;
     Ucs_Lld_Api_t *uniLld;
     void *uniLldHPtr;
-    UnicensCmdEntry_t *currentCmd;
 } UCSI_Data_t;
 
 #endif /* UNICENSINTEGRATION_H_ */
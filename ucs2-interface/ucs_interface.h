@@ -49,8 +49,10 @@ extern "C" {
  *                instance (static allocated or allocated with malloc)
  * \param pTag - Pointer given by the integrator. This pointer will be
  *               returned by any callback function of this component
+ * \param pCfg - Sizing and overflow policy of the command pool, content is copied.
+ *               NULL selects CMD_QUEUE_LEN, CMD_QUEUE_MAX_LEN and UCSI_QueuePolicy_Reject.
  */
-void UCSI_Init(UCSI_Data_t *pPriv, void *pTag);
+void UCSI_Init(UCSI_Data_t *pPriv, void *pTag, const UCSI_CmdQueueCfg_t *pCfg);
 
 
 /**
@@ -65,6 +67,16 @@ void UCSI_Init(UCSI_Data_t *pPriv, void *pTag);
  */
 bool UCSI_NewConfig(UCSI_Data_t *pPriv, UcsXmlVal_t *ucsConfig);
 
+/**
+ * \brief Selects, if node scripts are executed again when a node becomes
+ *        available again. Default is UCSI_ScriptPolicy_Always.
+ * \note Call this function only from the service context
+ *
+ * \param pPriv - private data section of this instance
+ * \param policy - see UCSI_ScriptPolicy_t
+ */
+void UCSI_SetScriptPolicy(UCSI_Data_t *pPriv, UCSI_ScriptPolicy_t policy);
+
 /**
  * \brief Offer the received control data from LLD to UNICENS
  * \note Call this function only from single context (not from ISR)
@@ -82,6 +94,121 @@ bool UCSI_NewConfig(UCSI_Data_t *pPriv, UcsXmlVal_t *ucsConfig);
  */
 bool UCSI_ProcessRxData(UCSI_Data_t *pPriv, const uint8_t *pBuffer, uint16_t len);
 
+/**
+ * \brief Starts a batch of received control telegrams. Until UCSI_RxBatchEnd
+ *        is called, UCSI_CB_OnServiceRequired is not raised by received data.
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ */
+void UCSI_RxBatchBegin(UCSI_Data_t *pPriv);
+
+/**
+ * \brief Finishes the batch started with UCSI_RxBatchBegin and requests
+ *        a single service run, if needed.
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ */
+void UCSI_RxBatchEnd(UCSI_Data_t *pPriv);
+
+/**
+ * \brief Gets an empty LLD message from UNICENS, so the integrator can
+ *        receive the control data directly into its data_ptr (zero-copy).
+ * \note Call this function only from single context (not from ISR)
+ * \note The message must be passed back with either UCSI_RxCommit or
+ *        UCSI_RxDiscard
+ *
+ * \param pPriv - private data section of this instance
+ * \param bufferSize - Maximum amount of bytes which will be written to data_ptr
+ * \return The LLD message, or NULL if no buffer is available. In this case
+ *         leave the data in the LLD queue and wait for
+ *         UCSI_CB_OnRxBufferAvailable.
+ */
+Ucs_Lld_RxMsg_t *UCSI_RxAllocate(UCSI_Data_t *pPriv, uint16_t bufferSize);
+
+/**
+ * \brief Passes a message filled by the integrator to UNICENS
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pMsg - The message returned by UCSI_RxAllocate
+ * \param len - Amount of bytes written to data_ptr
+ */
+void UCSI_RxCommit(UCSI_Data_t *pPriv, Ucs_Lld_RxMsg_t *pMsg, uint16_t len);
+
+/**
+ * \brief Gives back a message returned by UCSI_RxAllocate, which was not used
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pMsg - The message returned by UCSI_RxAllocate
+ */
+void UCSI_RxDiscard(UCSI_Data_t *pPriv, Ucs_Lld_RxMsg_t *pMsg);
+
+/**
+ * \brief Gives back a telegram passed by UCSI_CB_OnTxRequest, after the LLD
+ *        accepted (or discarded) all of its data
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pMsg - The message handle given by UCSI_CB_OnTxRequest
+ */
+void UCSI_TxRelease(UCSI_Data_t *pPriv, Ucs_Lld_TxMsg_t *pMsg);
+
+/**
+ * \brief Gets the statistics of the received control telegrams
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pStats - The statistics will be copied to this pointer
+ */
+void UCSI_GetRxStats(UCSI_Data_t *pPriv, UCSI_RxStats_t *pStats);
+
+/**
+ * \brief Gets the statistics of the command queue, one entry per priority lane
+ * \note Call this function only from the service context
+ *
+ * \param pPriv - private data section of this instance
+ * \param pStats - The statistics will be copied to this pointer
+ */
+void UCSI_GetCmdStats(UCSI_Data_t *pPriv, UCSI_CmdStats_t *pStats);
+
+/**
+ * \brief Gets the latency histograms of the commands, one entry per UnicensCmd_t
+ * \note Call this function only from the service context
+ * \note Only commands which got a result are recorded, dropped or aborted ones are not.
+ *
+ * \param pPriv - private data section of this instance
+ * \param pLatency - Array of UNICENS_CMD_COUNT entries, the histograms will be copied to it
+ * \param reset - true, start over with empty histograms after copying
+ */
+void UCSI_GetCmdLatency(UCSI_Data_t *pPriv, UCSI_CmdLatency_t *pLatency, bool reset);
+
+/**
+ * \brief Retrieves the runtime state of a node, without any network access
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param nodeAddress - The node address, as reported by UCSI_CB_OnMgrReport
+ * \param pState - The state will be copied to this pointer
+ *
+ * \return true, if the node is configured or was reported by the network.
+ */
+bool UCSI_GetNodeState(UCSI_Data_t *pPriv, uint16_t nodeAddress, UCSI_NodeState_t *pState);
+
+/**
+ * \brief Retrieves the runtime state of all known nodes
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pStates - The states will be copied to this array
+ * \param maxCount - Amount of entries in pStates
+ *
+ * \return Amount of states copied, at most UCS_NUM_REMOTE_DEVICES.
+ */
+uint8_t UCSI_GetNodeStates(UCSI_Data_t *pPriv, UCSI_NodeState_t *pStates, uint8_t maxCount);
+
 /**
  * \brief Gives UNICENS Integration module time to do its job
  * \note Call this function only from single context (not from ISR)
@@ -100,6 +227,41 @@ void UCSI_Service(UCSI_Data_t *pPriv);
  */
 void UCSI_Timeout(UCSI_Data_t *pPriv);
 
+/**
+ * \brief Call after timer set by UCSI_CB_OnSetCommandTimer
+ *        expired.
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ */
+void UCSI_CommandTimeout(UCSI_Data_t *pPriv);
+
+/**
+ * \brief Gets the monotonic time of this instance in microseconds
+ * \note Within a service pass (UCSI_Service, UCSI_Timeout) the time read at
+ *       the begin of the pass is returned, so all events of one pass share
+ *       the same timestamp.
+ *
+ * \param pPriv - private data section of this instance
+ * \return 64 bit monotonic time in microseconds, no wrap around
+ */
+uint64_t UCSI_GetTimeUs(UCSI_Data_t *pPriv);
+
+/**
+ * \brief Copies the recorded trace events, see UcsTrace_Read
+ * \note May be called from any thread (not from ISR), the trace ring is lock free
+ * \note Use UcsTrace_Format to get the text of a record
+ *
+ * \param pPriv - private data section of this instance
+ * \param pSince - Sequence number of the first record wanted, 0 for the oldest still kept.
+ *                 Will be set to the sequence number to pass with the next call.
+ * \param pRecords - Records will be copied to this array
+ * \param maxCount - Size of pRecords
+ * \param pLost - Will be set to the amount of wanted records, which were already overwritten. May be NULL.
+ * \return Amount of records copied
+ */
+uint16_t UCSI_ReadTrace(UCSI_Data_t *pPriv, uint32_t *pSince, UcsTrace_Record_t *pRecords, uint16_t maxCount, uint32_t *pLost);
+
 /**
  * \brief Sends an AMS message to the control channel
  *
@@ -115,6 +277,49 @@ void UCSI_Timeout(UCSI_Data_t *pPriv);
  */
 bool UCSI_SendAmsMessage(UCSI_Data_t *my, uint16_t msgId, uint16_t targetAddress, uint8_t *pPayload, uint32_t payloadLen);
 
+/**
+ * \brief Reserves an AMS TX message, so the integrator can build the payload
+ *        directly in its data_ptr (zero-copy).
+ * \note Call this function only from single context (not from ISR)
+ * \note The message must be passed back with either UCSI_AmsTxCommit or
+ *        UCSI_AmsTxDiscard
+ *
+ * \param pPriv - private data section of this instance
+ * \param payloadLen - Maximum amount of bytes which will be written to data_ptr
+ * \param ppMsg - The reserved message is stored here, NULL if none was reserved
+ * \return UCSI_AmsTx_Ok on success. UCSI_AmsTx_Busy if all messages are in use,
+ *         in this case wait for UCSI_CB_OnAmsTxAvailable. UCSI_AmsTx_Error if
+ *         the message can not be sent at all.
+ */
+UCSI_AmsTxStatus_t UCSI_AmsTxAllocate(UCSI_Data_t *pPriv, uint32_t payloadLen, Ucs_AmsTx_Msg_t **ppMsg);
+
+/**
+ * \brief Sends a message reserved by UCSI_AmsTxAllocate
+ * \note Call this function only from single context (not from ISR)
+ * \note On failure the message is given back, it must not be used anymore.
+ *
+ * \param pPriv - private data section of this instance
+ * \param pMsg - The message returned by UCSI_AmsTxAllocate
+ * \param msgId - The AMS message id
+ * \param targetAddress - The node / group target address
+ * \param payloadLen - Amount of bytes written to data_ptr
+ * \param result_fptr - Callback notifying the transmission result, result_ptr points to a Ucs_AmsTx_Result_t. May be NULL.
+ * \param request_ptr - User reference which is provided for the asynchronous result.
+ *
+ * \return true, if the message was handed over to UNICENS. The result is reported by result_fptr.
+ */
+bool UCSI_AmsTxCommit(UCSI_Data_t *pPriv, Ucs_AmsTx_Msg_t *pMsg, uint16_t msgId, uint16_t targetAddress,
+    uint32_t payloadLen, Ucsi_ResultCb_t result_fptr, void *request_ptr);
+
+/**
+ * \brief Gives back a message returned by UCSI_AmsTxAllocate, which was not used
+ * \note Call this function only from single context (not from ISR)
+ *
+ * \param pPriv - private data section of this instance
+ * \param pMsg - The message returned by UCSI_AmsTxAllocate
+ */
+void UCSI_AmsTxDiscard(UCSI_Data_t *pPriv, Ucs_AmsTx_Msg_t *pMsg);
+
 /**
  * \brief Gets the queued AMS message from UNICENS stack
  *
@@ -145,19 +350,36 @@ void UCSI_ReleaseAmsMessage(UCSI_Data_t *my);
 
 /**
  * \brief Enables or disables a route by the given routeId
- * \note Call this function only from single context (not from ISR)
+ * \note May be called from any thread (not from ISR)
+ * \note The routeId is resolved when the command is executed, unknown routes are reported there.
  *
  * \param pPriv - private data section of this instance
  * \param routeId - identifier as given in XML file along with MOST socket (unique)
  * \param isActive - true, route will become active. false, route will be deallocated
  * 
- * \return true, if route was found and the specific command was enqueued to UNICENS.
+ * \return true, if the specific command was enqueued to UNICENS.
  */
 bool UCSI_SetRouteActive(UCSI_Data_t *pPriv, uint16_t routeId, bool isActive);
 
+/**
+ * \brief Enables or disables all routes with the given name
+ * \note May be called from any thread (not from ISR)
+ * \note The name is resolved when the command is executed, unknown routes are reported there.
+ *
+ * \param pPriv - private data section of this instance
+ * \param routeName - name as given in XML file along with the sockets, shared by all sinks of one source
+ * \param isActive - true, routes will become active. false, routes will be deallocated
+ *
+ * \return true, if the specific command was enqueued to UNICENS.
+ */
+bool UCSI_SetRouteActiveByName(UCSI_Data_t *pPriv, const char *routeName, bool isActive);
+
 /**
  * \brief Enables or disables a route by the given routeId
- * \note Call this function only from single context (not from ISR)
+ * \note May be called from any thread (not from ISR)
+ * \note Single writes to the same node and slave with the same length, which
+ *       are queued within I2C_BURST_WINDOW_MS, are sent as one burst. Each
+ *       write still gets its own result callback.
  *
  * \param pPriv - private data section of this instance
  * \param targetAddress - targetAddress - The node / group target address
@@ -178,12 +400,13 @@ bool UCSI_I2CWrite(UCSI_Data_t *pPriv, uint16_t targetAddress, bool isBurst, uin
 
 /**
  * \brief Enables or disables a route by the given routeId
- * \note Call this function only from single context (not from ISR)
+ * \note May be called from any thread (not from ISR)
  *
  * \param pPriv - private data section of this instance
  * \param targetAddress - targetAddress - The node / group target address
  * \param gpioPinId - INIC GPIO PIN starting with 0 for the first GPIO.
  * \param isHighState - true, high state = 3,3V. false, low state = 0V.
+ * \note A write still waiting for the same node absorbs this one, the latest state per pin wins.
  *
  * \return true, if GPIO command was enqueued to UNICENS.
  */
@@ -196,10 +419,11 @@ bool UCSI_SetGpioState(UCSI_Data_t *pPriv, uint16_t targetAddress, uint8_t gpioP
 /**
  * \brief Callback when ever a timestamp is needed
  * \note This function must be implemented by the integrator
+ * \note Use the same monotonic clock as for UCSI_CB_OnSetServiceTimer
  * \param pTag - Pointer given by the integrator by UCSI_Init
- * \return timestamp in milliseconds
+ * \return monotonic timestamp in microseconds
  */
-extern uint16_t UCSI_CB_OnGetTime(void *pTag);
+extern uint64_t UCSI_CB_OnGetTime(void *pTag);
 
 
 /**
@@ -212,6 +436,17 @@ extern uint16_t UCSI_CB_OnGetTime(void *pTag);
  */
 extern void UCSI_CB_OnSetServiceTimer(void *pTag, uint16_t timeout);
 
+/**
+ * \brief Callback when the command queue needs to arm its timer, e.g. to
+ *        send I2C writes held back for burst aggregation.
+ * \note This function must be implemented by the integrator
+ * \note After timer expired, call the UCSI_CommandTimeout from service
+ *       Thread. (Not from callback!)
+ * \param pTag - Pointer given by the integrator by UCSI_Init
+ * \param timeout - milliseconds from now on to call back. (0=disable)
+ */
+extern void UCSI_CB_OnSetCommandTimer(void *pTag, uint16_t timeout);
+
 /**
  * \brief Callback when ever the state of the Network has changed.
  * \note This function must be implemented by the integrator
@@ -237,6 +472,8 @@ extern void UCSI_CB_OnUserMessage(void *pTag, bool isError, const char format[],
 /**
  * \brief Callback when ever this instance needs to be serviced.
  * \note Call UCSI_Service by your scheduler at the next run
+ * \note May be raised from any thread calling UCSI_SetRouteActive, UCSI_I2CWrite
+ *       or UCSI_SetGpioState. UCSI_Service must still run in the service context.
  * \note This function must be implemented by the integrator
  * \param pTag - Pointer given by the integrator by UCSI_Init
  */
@@ -245,12 +482,47 @@ extern void UCSI_CB_OnServiceRequired(void *pTag);
 /**
  * \brief Callback when ever this instance of UNICENS wants to send control data to the LLD.
  * \note This function must be implemented by the integrator
+ * \note The segments point into UNICENS memory (zero-copy). They stay valid
+ *       until UCSI_TxRelease is called with the given message.
  * \param pTag - Pointer given by the integrator by UCSI_Init
- * \param pPayload - Byte array to be sent on the INIC control channel
- * \param payloadLen - Length of pPayload in Byte
+ * \note The segments form one telegram. A character device without write_iter turns
+ *       every segment of a writev into a packet of its own, gather them first.
+ * \param pIov - Segments of the telegram to be sent on the INIC control channel
+ * \param iovCnt - Amount of entries in pIov
+ * \param pMsg - Message handle, pass it to UCSI_TxRelease once the LLD accepted all data
  */
 extern void UCSI_CB_OnTxRequest(void *pTag,
-    const uint8_t *pPayload, uint32_t payloadLen);
+    const struct iovec *pIov, int iovCnt, Ucs_Lld_TxMsg_t *pMsg);
+
+/**
+ * \brief Callback when UNICENS stops the LLD, e.g. on Stop or restart.
+ * \note This function must be implemented by the integrator
+ * \note All messages passed by UCSI_CB_OnTxRequest and not released yet must
+ *       be given back with UCSI_TxRelease within this callback and their
+ *       segments must not be accessed anymore. Afterwards UCSI_TxRelease is void.
+ * \param pTag - Pointer given by the integrator by UCSI_Init
+ */
+extern void UCSI_CB_OnTxStop(void *pTag);
+
+/**
+ * \brief Callback when LLD buffers are available again, after UCSI_RxAllocate
+ *        or UCSI_ProcessRxData failed because of lag of resources.
+ * \note This function must be implemented by the integrator
+ * \note Resume reading from the LLD now, this function is called from UNICENS context
+ * \param pTag - Pointer given by the integrator by UCSI_Init
+ */
+extern void UCSI_CB_OnRxBufferAvailable(void *pTag);
+
+/**
+ * \brief Callback when an AMS TX message is available again, after
+ *        UCSI_AmsTxAllocate returned UCSI_AmsTx_Busy.
+ * \note This function must be implemented by the integrator
+ * \note This function is called from UNICENS context, which may still hold
+ *       the message just completed. Schedule the next UCSI_AmsTxAllocate,
+ *       do not call it from within this callback.
+ * \param pTag - Pointer given by the integrator by UCSI_Init
+ */
+extern void UCSI_CB_OnAmsTxAvailable(void *pTag);
 
 /**
  * \brief Callback when UNICENS instance has been stopped.
@@ -29,6 +29,7 @@
 /*------------------------------------------------------------------------------------------------*/
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "ucs_interface.h"
 
 /************************************************************************/
@@ -40,12 +41,60 @@
 /* Private Function Prototypes                                          */
 /************************************************************************/
 static bool EnqueueCommand(UCSI_Data_t *my, UnicensCmdEntry_t *cmd);
-static void OnCommandExecuted(UCSI_Data_t *my, UnicensCmd_t cmd);
-static void RB_Init(RB_t *rb, uint16_t amountOfEntries, uint32_t sizeOfEntry, uint8_t *workingBuffer);
-static void *RB_GetReadPtr(RB_t *rb);
-static void RB_PopReadPtr(RB_t *rb);
-static void *RB_GetWritePtr(RB_t *rb);
-static void RB_PopWritePtr(RB_t *rb);
+static bool QueueCommand(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd);
+static void EnsureGpioPort(UCSI_Data_t *my, uint16_t nodeAddress);
+static bool CoalesceCommand(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd);
+static bool MergeGpioWrite(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd);
+static void FoldGpioWrite(UnicensCmdGpioWritePort_t *dst, const UnicensCmdGpioWritePort_t *src);
+static bool DropOldestCommand(UCSI_Data_t *my, UnicensCmd_t cmd);
+static bool SubmitCommand(UCSI_Data_t *my, UnicensCmdEntry_t *cmd);
+static void DrainIngress(UCSI_Data_t *my);
+static Ucs_Rm_Route_t *FindRoute(UCSI_Data_t *my, uint16_t routeId);
+static uint16_t FindRouteByName(UCSI_Data_t *my, const char *routeName);
+static Ucs_Return_t SetRoutesByName(UCSI_Data_t *my, const UnicensCmdRmSetRoute_t *cmd);
+static bool RouteIndex_Build(UCSI_RouteIndex_t *idx, Ucs_Rm_Route_t *routes, const char **names, uint16_t count);
+static uint32_t RouteIndex_HashId(uint16_t routeId);
+static uint32_t RouteIndex_HashName(const char *routeName);
+static UnicensCmdResult_t ExecuteCommand(UCSI_Data_t *my, UCSI_Cmd_t *c);
+static uint16_t CommandDestination(const UnicensCmdEntry_t *e);
+static UCSI_Lane_t CommandLane(UnicensCmd_t cmd);
+static void DispatchLane(UCSI_Data_t *my, UCSI_Lane_t lane, uint64_t now, uint64_t *pDueUs);
+static bool HoldI2cBurst(UCSI_Data_t *my, UCSI_Cmd_t *c, uint64_t now, uint64_t *pDueUs);
+static void NotifyI2cWrite(UCSI_Data_t *my, UCSI_Cmd_t *c, void *result_ptr);
+static void ArmCommandTimer(UCSI_Data_t *my, uint64_t dueUs, uint64_t now);
+static bool IsLaneStarving(UCSI_Data_t *my, UCSI_Lane_t lane, uint64_t now);
+static UCSI_Cmd_t *FindInFlight(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress);
+static void AbortInFlight(UCSI_Data_t *my);
+static void WarmRestart(UCSI_Data_t *my);
+static void MarkInFlight(UCSI_Data_t *my, UCSI_Cmd_t *c, UCSI_Lane_t lane, uint64_t now);
+static uint32_t ScriptDeadlineMs(const Ucs_Rm_Node_t *node);
+static void ExpireInFlight(UCSI_Data_t *my, uint64_t now);
+static uint64_t NextDeadline(UCSI_Data_t *my);
+static bool IsLateResult(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress);
+static void ForgetExpired(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress);
+static bool DispatchLifecycle(UCSI_Data_t *my, uint64_t now);
+static void DispatchCommand(UCSI_Data_t *my);
+static void TimeCacheBegin(UCSI_Data_t *my);
+static void TimeCacheEnd(UCSI_Data_t *my);
+static void OnCommandExecuted(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress);
+static void RecordLatency(UCSI_Data_t *my, UnicensCmd_t cmd, uint64_t submittedUs, uint64_t dispatchedUs);
+static void LatencyHisto_Add(UCSI_LatencyHisto_t *h, uint64_t startUs, uint64_t endUs);
+static void Ingress_Init(UCSI_Ingress_t *q);
+static bool Ingress_Push(UCSI_Ingress_t *q, const UnicensCmdEntry_t *cmd);
+static UnicensCmdEntry_t *Ingress_Peek(UCSI_Ingress_t *q);
+static void Ingress_Pop(UCSI_Ingress_t *q);
+static void NodeTable_Load(UCSI_NodeTable_t *t, Ucs_Rm_Node_t *nodes, const bool *gpio, uint16_t count);
+static UCSI_NodeState_t *NodeTable_Get(UCSI_NodeTable_t *t, uint16_t nodeAddress, bool create);
+static uint32_t ScriptFingerprint(const Ucs_Rm_Node_t *node);
+static uint32_t Fnv1a(uint32_t hash, const void *data, uint32_t len);
+static void CmdPool_Init(UCSI_Data_t *my, const UCSI_CmdQueueCfg_t *pCfg);
+static bool CmdPool_Grow(UCSI_Data_t *my, uint16_t amount);
+static bool CmdPool_HasRoom(UCSI_Data_t *my);
+static UCSI_Cmd_t *CmdPool_Alloc(UCSI_Data_t *my);
+static void CmdList_Append(UCSI_Data_t *my, UCSI_Cmd_t *c);
+static void CmdList_Remove(UCSI_Data_t *my, UCSI_Cmd_t *c);
+static void CmdList_Unlink(UCSI_Data_t *my, UCSI_Cmd_t *c);
+static void CmdPool_Free(UCSI_Data_t *my, UCSI_Cmd_t *c);
 static uint16_t OnUnicensGetTime(void *user_ptr);
 static void OnUnicensService( void *user_ptr );
 static void OnUnicensError( Ucs_Error_t error_code, void *user_ptr );
@@ -69,6 +118,9 @@ static void OnUcsGpioPortWrite(uint16_t node_address, uint16_t gpio_port_handle,
 static void OnUcsMgrReport(Ucs_MgrReport_t code, uint16_t node_address, Ucs_Rm_Node_t *node_ptr, void *user_ptr);
 static void OnUcsNsRun(Ucs_Rm_Node_t * node_ptr, Ucs_Ns_ResultCode_t result, void *ucs_user_ptr);
 static void OnUcsAmsRxMsgReceived(void *user_ptr);
+static void OnUcsAmsTxComplete(Ucs_AmsTx_Msg_t *msg_ptr, Ucs_AmsTx_Result_t result, Ucs_AmsTx_Info_t info, void *user_ptr);
+static void AmsTxCtx_Init(UCSI_Data_t *my);
+static void AmsTxCtx_Free(UCSI_Data_t *my, UCSI_AmsTxCtx_t *ctx);
 static void OnUcsGpioTriggerEventStatus(uint16_t node_address, uint16_t gpio_port_handle,
     uint16_t rising_edges, uint16_t falling_edges, uint16_t levels, void * user_ptr);
 static void OnUcsI2CWrite(uint16_t node_address, uint16_t i2c_port_handle,
@@ -78,7 +130,7 @@ static void OnUcsI2CWrite(uint16_t node_address, uint16_t i2c_port_handle,
 /* Public Function Implementations                                      */
 /************************************************************************/
 
-void UCSI_Init(UCSI_Data_t *my, void *pTag)
+void UCSI_Init(UCSI_Data_t *my, void *pTag, const UCSI_CmdQueueCfg_t *pCfg)
 {
     Ucs_Return_t result;
     assert(NULL != my);
@@ -125,19 +177,23 @@ void UCSI_Init(UCSI_Data_t *my, void *pTag)
 
     my->uniInitData.gpio.trigger_event_status_fptr = &OnUcsGpioTriggerEventStatus;
 
-    RB_Init(&my->rb, CMD_QUEUE_LEN, sizeof(UnicensCmdEntry_t), my->rbBuf);
+    Ingress_Init(&my->ingress);
+    UcsTrace_Init(&my->trace);
+    CmdPool_Init(my, pCfg);
+    AmsTxCtx_Init(my);
 }
 
 bool UCSI_NewConfig(UCSI_Data_t *my, UcsXmlVal_t *ucsConfig) {
 
-    UnicensCmdEntry_t *e;
+    UCSI_Cmd_t *c;
     assert(MAGIC == my->magic);
     if (my->initialized)
     {
-        e = (UnicensCmdEntry_t *)RB_GetWritePtr(&my->rb);
-        if (NULL == e) return false;
-        e->cmd = UnicensCmd_Stop;
-        RB_PopWritePtr(&my->rb);
+        c = CmdPool_Alloc(my);
+        if (NULL == c) return false;
+        c->e.cmd = UnicensCmd_Stop;
+        c->e.submittedUs = UCSI_GetTimeUs(my);
+        CmdList_Append(my, c);
     }
     my->uniInitData.mgr.packet_bw = ucsConfig->packetBw;
     my->uniInitData.mgr.routes_list_ptr = ucsConfig->pRoutes;
@@ -145,78 +201,1123 @@ bool UCSI_NewConfig(UCSI_Data_t *my, UcsXmlVal_t *ucsConfig) {
     my->uniInitData.mgr.nodes_list_ptr = ucsConfig->pNod;
     my->uniInitData.mgr.nodes_list_size = ucsConfig->nodSize;
     my->uniInitData.mgr.enabled = true;
-    e = (UnicensCmdEntry_t *)RB_GetWritePtr(&my->rb);
-    if (NULL == e) return false;
-    e->cmd =  UnicensCmd_Init;
-    e->val.Init.init_ptr = &my->uniInitData;
-    RB_PopWritePtr(&my->rb);
+    if (!RouteIndex_Build(&my->routeIdx, ucsConfig->pRoutes, ucsConfig->pRouteNames, ucsConfig->routesSize))
+        UCSI_CB_OnUserMessage(my->tag, true, "Can not allocate route index, routes=%d", 1, ucsConfig->routesSize);
+    NodeTable_Load(&my->nodeTable, ucsConfig->pNod, ucsConfig->pNodGpio, ucsConfig->nodSize);
+    c = CmdPool_Alloc(my);
+    if (NULL == c) return false;
+    c->e.cmd =  UnicensCmd_Init;
+    c->e.val.Init.init_ptr = &my->uniInitData;
+    c->e.submittedUs = UCSI_GetTimeUs(my);
+    CmdList_Append(my, c);
     UCSI_CB_OnServiceRequired(my->tag);
     return true;
 }
 
+void UCSI_SetScriptPolicy(UCSI_Data_t *my, UCSI_ScriptPolicy_t policy)
+{
+    assert(MAGIC == my->magic);
+    my->scriptPolicy = policy;
+}
+
 bool UCSI_ProcessRxData(UCSI_Data_t *my,
     const uint8_t *pBuffer, uint16_t len)
 {
     Ucs_Lld_RxMsg_t *msg = NULL;
     assert(MAGIC == my->magic);
-    if (NULL == my->uniLld || NULL == my->uniLldHPtr) return false;
-    msg = my->uniLld->rx_allocate_fptr(my->uniLldHPtr, len);
+    msg = UCSI_RxAllocate(my, len);
     if (NULL == msg)
     {
         /*This may happen by definition, OnLldCtrlRxMsgAvailable()
           will be called, once buffers are available again*/
         return false;
     }
-    msg->data_size = len;
     memcpy(msg->data_ptr, pBuffer, len);
-    my->uniLld->rx_receive_fptr(my->uniLldHPtr, msg);
+    UCSI_RxCommit(my, msg, len);
     return true;
 }
 
+void UCSI_RxBatchBegin(UCSI_Data_t *my)
+{
+    assert(MAGIC == my->magic);
+    /* Collect the service requests of every telegram, serve them once afterwards */
+    my->rxBatchActive = true;
+    my->rxBatchFrames = 0;
+}
+
+void UCSI_RxBatchEnd(UCSI_Data_t *my)
+{
+    uint16_t count;
+    assert(MAGIC == my->magic);
+    my->rxBatchActive = false;
+    count = my->rxBatchFrames;
+    ++my->rxStats.wakeups;
+    if (0 != count)
+    {
+        if (count > my->rxStats.maxFramesPerWakeup)
+            my->rxStats.maxFramesPerWakeup = count;
+        ++my->rxStats.framesPerWakeup[(count < RX_BATCH_HISTO_LEN) ? (count - 1) : (RX_BATCH_HISTO_LEN - 1)];
+    }
+    if (my->triggerService)
+        UCSI_CB_OnServiceRequired(my->tag);
+}
+
+Ucs_Lld_RxMsg_t *UCSI_RxAllocate(UCSI_Data_t *my, uint16_t bufferSize)
+{
+    Ucs_Lld_RxMsg_t *msg = NULL;
+    assert(MAGIC == my->magic);
+    if (NULL != my->uniLld && NULL != my->uniLldHPtr)
+        msg = my->uniLld->rx_allocate_fptr(my->uniLldHPtr, bufferSize);
+    if (NULL == msg)
+    {
+        /* Remember to notify the integrator, when OnLldCtrlStart() or OnLldCtrlRxMsgAvailable() is called */
+        my->rxStarved = true;
+        ++my->rxStats.rejected;
+    }
+    return msg;
+}
+
+void UCSI_RxCommit(UCSI_Data_t *my, Ucs_Lld_RxMsg_t *pMsg, uint16_t len)
+{
+    assert(MAGIC == my->magic);
+    assert(NULL != pMsg);
+    if (NULL == my->uniLld || NULL == my->uniLldHPtr) return;
+    pMsg->data_size = len;
+    my->uniLld->rx_receive_fptr(my->uniLldHPtr, pMsg);
+    ++my->rxBatchFrames;
+    ++my->rxStats.frames;
+}
+
+void UCSI_RxDiscard(UCSI_Data_t *my, Ucs_Lld_RxMsg_t *pMsg)
+{
+    assert(MAGIC == my->magic);
+    assert(NULL != pMsg);
+    if (NULL == my->uniLld || NULL == my->uniLldHPtr) return;
+    my->uniLld->rx_free_unused_fptr(my->uniLldHPtr, pMsg);
+}
+
+void UCSI_TxRelease(UCSI_Data_t *my, Ucs_Lld_TxMsg_t *pMsg)
+{
+    assert(MAGIC == my->magic);
+    assert(NULL != pMsg);
+    if (NULL == my->uniLld || NULL == my->uniLldHPtr) return;
+    my->uniLld->tx_release_fptr(my->uniLldHPtr, pMsg);
+}
+
+void UCSI_GetRxStats(UCSI_Data_t *my, UCSI_RxStats_t *pStats)
+{
+    assert(MAGIC == my->magic);
+    if (NULL == pStats) return;
+    memcpy(pStats, &my->rxStats, sizeof(UCSI_RxStats_t));
+}
+
 void UCSI_Service(UCSI_Data_t *my)
 {
-    Ucs_Return_t ret;
-    UnicensCmdEntry_t *e;
-    bool popEntry = true; /*Set to false in specific case, where function will callback asynchrony.*/
     assert(MAGIC == my->magic);
+    TimeCacheBegin(my);
     if (NULL != my->unicens && my->triggerService) {
         my->triggerService = false;
         Ucs_Service(my->unicens);
     }
-    if (NULL != my->currentCmd) return;
-    my->currentCmd = e = (UnicensCmdEntry_t *)RB_GetReadPtr(&my->rb);
-    if (NULL == e) return;
+    DrainIngress(my);
+    DispatchCommand(my);
+    /* commands finished synchronously may have freed room for still submitted ones */
+    if (CmdPool_HasRoom(my) && NULL != Ingress_Peek(&my->ingress))
+        UCSI_CB_OnServiceRequired(my->tag);
+    TimeCacheEnd(my);
+}
+
+void UCSI_Timeout(UCSI_Data_t *my)
+{
+    assert(MAGIC == my->magic);
+    if (NULL == my->unicens) return;
+    TimeCacheBegin(my);
+    Ucs_ReportTimeout(my->unicens);
+    TimeCacheEnd(my);
+}
+
+void UCSI_CommandTimeout(UCSI_Data_t *my)
+{
+    assert(MAGIC == my->magic);
+    /* the one-shot timer is gone, the next dispatch run arms it again if needed */
+    my->cmdTimerDueUs = 0;
+    TimeCacheBegin(my);
+    DispatchCommand(my);
+    TimeCacheEnd(my);
+}
+
+void UCSI_GetCmdStats(UCSI_Data_t *my, UCSI_CmdStats_t *pStats)
+{
+    assert(MAGIC == my->magic);
+    if (NULL == pStats) return;
+    memcpy(&pStats->pool, &my->poolStats, sizeof(pStats->pool));
+    memcpy(&pStats->restart, &my->restartStats, sizeof(pStats->restart));
+    pStats->pool.ingressRejected = atomic_load(&my->ingress.rejected);
+    memcpy(pStats->lanes, my->laneStats, sizeof(pStats->lanes));
+    pStats->inFlight = my->inFlightCnt;
+    pStats->scriptsInFlight = my->scriptsInFlight;
+}
+
+bool UCSI_GetNodeState(UCSI_Data_t *my, uint16_t nodeAddress, UCSI_NodeState_t *pState)
+{
+    UCSI_NodeState_t *n;
+    assert(MAGIC == my->magic);
+    n = NodeTable_Get(&my->nodeTable, nodeAddress, false);
+    if (NULL == n || NULL == pState) return false;
+    memcpy(pState, n, sizeof(UCSI_NodeState_t));
+    return true;
+}
+
+uint8_t UCSI_GetNodeStates(UCSI_Data_t *my, UCSI_NodeState_t *pStates, uint8_t maxCount)
+{
+    uint8_t count;
+    assert(MAGIC == my->magic);
+    if (NULL == pStates) return 0;
+    count = my->nodeTable.count;
+    if (count > maxCount)
+        count = maxCount;
+    memcpy(pStates, my->nodeTable.nodes, count * sizeof(UCSI_NodeState_t));
+    return count;
+}
+
+void UCSI_GetCmdLatency(UCSI_Data_t *my, UCSI_CmdLatency_t *pLatency, bool reset)
+{
+    assert(MAGIC == my->magic);
+    if (NULL == pLatency) return;
+    memcpy(pLatency, my->latency, sizeof(my->latency));
+    if (reset)
+        memset(my->latency, 0, sizeof(my->latency));
+}
+
+uint64_t UCSI_GetTimeUs(UCSI_Data_t *my)
+{
+    assert(MAGIC == my->magic);
+    if (my->time.cacheValid)
+        return my->time.cachedUs;
+    return UCSI_CB_OnGetTime(my->tag);
+}
+
+uint16_t UCSI_ReadTrace(UCSI_Data_t *my, uint32_t *pSince, UcsTrace_Record_t *pRecords, uint16_t maxCount, uint32_t *pLost)
+{
+    assert(MAGIC == my->magic);
+    return UcsTrace_Read(&my->trace, pSince, pRecords, maxCount, pLost);
+}
+
+bool UCSI_SendAmsMessage(UCSI_Data_t *my, uint16_t msgId, uint16_t targetAddress, uint8_t *pPayload, uint32_t payloadLen)
+{
+    Ucs_AmsTx_Msg_t *msg;
+    assert(MAGIC == my->magic);
+    if (UCSI_AmsTx_Ok != UCSI_AmsTxAllocate(my, payloadLen, &msg)) return false;
+    if (0 != payloadLen)
+    {
+        assert(NULL != msg->data_ptr);
+        memcpy(msg->data_ptr, pPayload, payloadLen);
+    }
+    return UCSI_AmsTxCommit(my, msg, msgId, targetAddress, payloadLen, NULL, NULL);
+}
+
+UCSI_AmsTxStatus_t UCSI_AmsTxAllocate(UCSI_Data_t *my, uint32_t payloadLen, Ucs_AmsTx_Msg_t **ppMsg)
+{
+    Ucs_AmsTx_Msg_t *msg;
+    UCSI_AmsTxCtx_t *ctx;
+    assert(MAGIC == my->magic);
+    if (NULL == ppMsg) return UCSI_AmsTx_Error;
+    *ppMsg = NULL;
+    if (NULL == my->unicens || payloadLen > UCS_AMS_SIZE_TX_MSG) return UCSI_AmsTx_Error;
+    ctx = my->amsTxFree;
+    msg = (NULL != ctx) ? Ucs_AmsTx_AllocMsg(my->unicens, payloadLen) : NULL;
+    if (NULL == msg)
+    {
+        /* Remember to notify the integrator, when OnUcsAmsTxComplete() gives a message back */
+        my->amsTxStarved = true;
+        return UCSI_AmsTx_Busy;
+    }
+    my->amsTxFree = ctx->next;
+    ctx->result_fptr = NULL;
+    ctx->request_ptr = NULL;
+    ctx->next = NULL;
+    msg->custom_info_ptr = ctx;
+    msg->data_size = payloadLen;
+    *ppMsg = msg;
+    return UCSI_AmsTx_Ok;
+}
+
+bool UCSI_AmsTxCommit(UCSI_Data_t *my, Ucs_AmsTx_Msg_t *msg, uint16_t msgId, uint16_t targetAddress,
+    uint32_t payloadLen, Ucsi_ResultCb_t result_fptr, void *request_ptr)
+{
+    UCSI_AmsTxCtx_t *ctx;
+    Ucs_Return_t result;
+    assert(MAGIC == my->magic);
+    if (NULL == msg) return false;
+    ctx = (UCSI_AmsTxCtx_t *)msg->custom_info_ptr;
+    assert(NULL != ctx);
+    if (payloadLen > msg->data_size)
+    {
+        UCSI_AmsTxDiscard(my, msg);
+        return false;
+    }
+    ctx->result_fptr = result_fptr;
+    ctx->request_ptr = request_ptr;
+    msg->data_size = payloadLen;
+    msg->destination_address = targetAddress;
+    msg->llrbc = 10;
+    msg->msg_id = msgId;
+    result = Ucs_AmsTx_SendMsg(my->unicens, msg, OnUcsAmsTxComplete);
+    if (UCS_RET_SUCCESS != result)
+    {
+        UCSI_CB_OnUserMessage(my->tag, true, "Ucs_AmsTx_SendMsg failed ret=%d", 1, result);
+        UCSI_AmsTxDiscard(my, msg);
+    }
+    return UCS_RET_SUCCESS == result;
+}
+
+void UCSI_AmsTxDiscard(UCSI_Data_t *my, Ucs_AmsTx_Msg_t *msg)
+{
+    UCSI_AmsTxCtx_t *ctx;
+    assert(MAGIC == my->magic);
+    if (NULL == msg) return;
+    ctx = (UCSI_AmsTxCtx_t *)msg->custom_info_ptr;
+    msg->custom_info_ptr = NULL;
+    Ucs_AmsTx_FreeUnusedMsg(my->unicens, msg);
+    AmsTxCtx_Free(my, ctx);
+}
+
+bool UCSI_GetAmsMessage(UCSI_Data_t *my, uint16_t *pMsgId, uint16_t *pSourceAddress, uint8_t **pPayload, uint32_t *pPayloadLen)
+{
+    Ucs_AmsRx_Msg_t *msg;
+    assert(MAGIC == my->magic);
+    if (NULL == my->unicens || NULL == pPayload || NULL == pPayloadLen) return false;
+    msg = Ucs_AmsRx_PeekMsg(my->unicens);
+    if (NULL == msg) return false;
+    *pMsgId = msg->msg_id;
+    *pSourceAddress = msg->source_address;
+    *pPayload = msg->data_ptr;
+    *pPayloadLen = msg->data_size;
+    return true;
+}
+
+void UCSI_ReleaseAmsMessage(UCSI_Data_t *my)
+{
+    assert(MAGIC == my->magic);
+    if (NULL == my->unicens) return;
+    Ucs_AmsRx_ReleaseMsg(my->unicens);
+}
+
+bool UCSI_SetRouteActive(UCSI_Data_t *my, uint16_t routeId, bool isActive)
+{
+    UnicensCmdEntry_t entry;
+    assert(MAGIC == my->magic);
+    if (NULL == my) return false;
+    /* route list belongs to the service context, routeId is resolved on dispatch */
+    entry.cmd = UnicensCmd_RmSetRoute;
+    entry.val.RmSetRoute.routeId = routeId;
+    entry.val.RmSetRoute.routeName[0] = '\0';
+    entry.val.RmSetRoute.isActive = isActive;
+    return SubmitCommand(my, &entry);
+}
+
+bool UCSI_SetRouteActiveByName(UCSI_Data_t *my, const char *routeName, bool isActive)
+{
+    UnicensCmdEntry_t entry;
+    assert(MAGIC == my->magic);
+    if (NULL == my || NULL == routeName || '\0' == routeName[0]) return false;
+    if (strlen(routeName) >= ROUTE_NAME_MAX_LEN) return false;
+    entry.cmd = UnicensCmd_RmSetRoute;
+    entry.val.RmSetRoute.routeId = 0;
+    strcpy(entry.val.RmSetRoute.routeName, routeName);
+    entry.val.RmSetRoute.isActive = isActive;
+    return SubmitCommand(my, &entry);
+}
+
+bool UCSI_I2CWrite(UCSI_Data_t *my, uint16_t targetAddress, bool isBurst, uint8_t blockCount,
+    uint8_t slaveAddr, uint16_t timeout, uint8_t dataLen, uint8_t *pData, 
+    Ucsi_ResultCb_t result_fptr, void *request_ptr)
+{
+    UnicensCmdEntry_t entry;
+    assert(MAGIC == my->magic);
+    if (NULL == my || NULL == pData || 0 == dataLen) return false;
+    if (dataLen > I2C_WRITE_MAX_LEN) return false;
+    entry.cmd = UnicensCmd_I2CWrite;
+    entry.val.I2CWrite.destination = targetAddress;
+    entry.val.I2CWrite.isBurst = isBurst;
+    entry.val.I2CWrite.blockCount = blockCount;
+    entry.val.I2CWrite.slaveAddr = slaveAddr;
+    entry.val.I2CWrite.timeout = timeout;
+    entry.val.I2CWrite.dataLen = dataLen;
+    entry.val.I2CWrite.result_fptr = result_fptr;
+    entry.val.I2CWrite.request_ptr = request_ptr;
+    memcpy(entry.val.I2CWrite.data, pData, dataLen);
+    return SubmitCommand(my, &entry);
+}
+
+bool UCSI_SetGpioState(UCSI_Data_t *my, uint16_t targetAddress, uint8_t gpioPinId, bool isHighState)
+{
+    uint16_t mask;
+    UnicensCmdEntry_t entry;
+    assert(MAGIC == my->magic);
+    if (NULL == my) return false;
+    mask = 1 << gpioPinId;
+    entry.cmd = UnicensCmd_GpioWritePort;
+    entry.val.GpioWritePort.destination = targetAddress;
+    entry.val.GpioWritePort.mask = mask;
+    entry.val.GpioWritePort.data = isHighState ? mask : 0;
+    return SubmitCommand(my, &entry);
+}
+
+/************************************************************************/
+/* Private Functions                                                    */
+/************************************************************************/
+/* Service context only (UNICENS callbacks), foreign threads use SubmitCommand */
+static bool EnqueueCommand(UCSI_Data_t *my, UnicensCmdEntry_t *cmd)
+{
+    if (NULL == my || NULL == cmd)
+    {
+        assert(false);
+        return false;
+    }
+    cmd->submittedUs = UCSI_GetTimeUs(my);
+    if (!QueueCommand(my, cmd))
+    {
+        my->poolStats.rejected++;
+        UCSI_CB_OnUserMessage(my->tag, true, "Could not enqueue command. Increase CMD_QUEUE_MAX_LEN or change queue policy", 0);
+        return false;
+    }
+    UCSI_CB_OnServiceRequired(my->tag);
+    return true;
+}
+
+/* Takes a free command (growing the pool if allowed), or applies the overflow policy */
+static bool QueueCommand(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd)
+{
+    UCSI_Cmd_t *c;
+    if (UnicensCmd_GpioWritePort == cmd->cmd)
+        EnsureGpioPort(my, cmd->val.GpioWritePort.destination);
+    if (UnicensCmd_GpioWritePort == cmd->cmd && MergeGpioWrite(my, cmd))
+    {
+        my->poolStats.gpioMerged++;
+        return true;
+    }
+    c = CmdPool_Alloc(my);
+    if (NULL == c)
+    {
+        switch (my->cmdCfg.policy)
+        {
+        case UCSI_QueuePolicy_Coalesce:
+            if (CoalesceCommand(my, cmd))
+            {
+                my->poolStats.coalesced++;
+                return true;
+            }
+            break;
+        case UCSI_QueuePolicy_DropOldest:
+            if (DropOldestCommand(my, cmd->cmd))
+            {
+                my->poolStats.dropped++;
+                c = CmdPool_Alloc(my);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (NULL == c)
+        return false; /* counted by the caller, ingress entries are retried */
+    memcpy(&c->e, cmd, sizeof(UnicensCmdEntry_t));
+    CmdList_Append(my, c);
+    return true;
+}
+
+/* Merges cmd into a waiting command with same kind and target, newest values win */
+static bool CoalesceCommand(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd)
+{
+    UCSI_Cmd_t *c;
+    for (c = my->lanes[CommandLane(cmd->cmd)].head; NULL != c; c = c->next)
+    {
+        if (c->inFlight || c->e.cmd != cmd->cmd)
+            continue;
+        switch (cmd->cmd)
+        {
+        case UnicensCmd_RmSetRoute:
+            if (c->e.val.RmSetRoute.routeId != cmd->val.RmSetRoute.routeId
+                || 0 != strcmp(c->e.val.RmSetRoute.routeName, cmd->val.RmSetRoute.routeName))
+                continue;
+            c->e.val.RmSetRoute.isActive = cmd->val.RmSetRoute.isActive;
+            return true;
+        case UnicensCmd_GpioCreatePort:
+            if (c->e.val.GpioCreatePort.destination != cmd->val.GpioCreatePort.destination)
+                continue;
+            c->e.val.GpioCreatePort.debounceTime = cmd->val.GpioCreatePort.debounceTime;
+            return true;
+        case UnicensCmd_GpioWritePort:
+            if (c->e.val.GpioWritePort.destination != cmd->val.GpioWritePort.destination)
+                continue;
+            FoldGpioWrite(&c->e.val.GpioWritePort, &cmd->val.GpioWritePort);
+            return true;
+        default:
+            /* I2C payloads, scripts and lifecycle commands can not be merged */
+            return false;
+        }
+    }
+    return false;
+}
+
+/*
+ * Queues the creation of the node's GPIO port ahead of a write, unless the
+ * port exists or its creation is already queued. Per node ordering of the
+ * GPIO lane makes the write wait for it.
+ */
+static void EnsureGpioPort(UCSI_Data_t *my, uint16_t nodeAddress)
+{
+    UnicensCmdEntry_t e;
+    UCSI_NodeState_t *n;
+    UCSI_Cmd_t *c;
+    n = NodeTable_Get(&my->nodeTable, nodeAddress, false);
+    /* untracked nodes got their port eagerly, unavailable ones get it once they are back */
+    if (NULL == n || !n->available || 0 != n->gpioPortHandle)
+        return;
+    for (c = my->lanes[UCSI_Lane_Gpio].head; NULL != c; c = c->next)
+    {
+        if (UnicensCmd_GpioCreatePort == c->e.cmd && nodeAddress == c->e.val.GpioCreatePort.destination)
+            return;
+    }
+    e.cmd = UnicensCmd_GpioCreatePort;
+    e.val.GpioCreatePort.destination = nodeAddress;
+    e.val.GpioCreatePort.debounceTime = GPIO_DEBOUNCE_MS;
+    EnqueueCommand(my, &e);
+}
+
+/*
+ * Folds a GPIO write into the last queued command for the same node, if that
+ * one is a GPIO write still waiting. Anything queued for the node after it
+ * (e.g. a new GpioCreatePort) keeps the new write behind it.
+ */
+static bool MergeGpioWrite(UCSI_Data_t *my, const UnicensCmdEntry_t *cmd)
+{
+    UCSI_Cmd_t *c;
+    UCSI_Cmd_t *last = NULL;
+    for (c = my->lanes[UCSI_Lane_Gpio].head; NULL != c; c = c->next)
+    {
+        if (CommandDestination(&c->e) == cmd->val.GpioWritePort.destination)
+            last = c;
+    }
+    if (NULL == last || last->inFlight || UnicensCmd_GpioWritePort != last->e.cmd)
+        return false;
+    FoldGpioWrite(&last->e.val.GpioWritePort, &cmd->val.GpioWritePort);
+    return true;
+}
+
+/* Latest state wins per pin, pins untouched by src keep their pending state */
+static void FoldGpioWrite(UnicensCmdGpioWritePort_t *dst, const UnicensCmdGpioWritePort_t *src)
+{
+    dst->data = (dst->data & ~src->mask) | (src->data & src->mask);
+    dst->mask |= src->mask;
+}
+
+/* Frees the oldest waiting command of the given kind, its requester is notified */
+static bool DropOldestCommand(UCSI_Data_t *my, UnicensCmd_t cmd)
+{
+    UCSI_Cmd_t *c;
+    if (UCSI_Lane_Lifecycle == CommandLane(cmd))
+        return false;
+    for (c = my->lanes[CommandLane(cmd)].head; NULL != c; c = c->next)
+    {
+        if (c->inFlight || c->e.cmd != cmd)
+            continue;
+        UCSI_CB_OnUserMessage(my->tag, true, "Command queue full, dropping oldest command=0x%X", 1, cmd);
+        if (UnicensCmd_I2CWrite == cmd)
+            NotifyI2cWrite(my, c, NULL /*processing error*/);
+        CmdList_Remove(my, c);
+        return true;
+    }
+    return false;
+}
+
+/* Called by any thread, the command reaches the service queue with the next UCSI_Service */
+static bool SubmitCommand(UCSI_Data_t *my, UnicensCmdEntry_t *cmd)
+{
+    if (NULL == my || NULL == cmd)
+    {
+        assert(false);
+        return false;
+    }
+    /* the time cache belongs to the service context, read the clock directly */
+    cmd->submittedUs = UCSI_CB_OnGetTime(my->tag);
+    if (!Ingress_Push(&my->ingress, cmd))
+    {
+        atomic_fetch_add(&my->ingress.rejected, 1);
+        UCSI_CB_OnUserMessage(my->tag, true, "Could not submit command. Increase CMD_INGRESS_LEN define", 0);
+        return false;
+    }
+    UCSI_CB_OnServiceRequired(my->tag);
+    return true;
+}
+
+/* Move submitted commands into the service queue, keeps submission order */
+static void DrainIngress(UCSI_Data_t *my)
+{
+    UnicensCmdEntry_t *src;
+    while (NULL != (src = Ingress_Peek(&my->ingress)))
+    {
+        if (!QueueCommand(my, src))
+            break; /* remaining entries wait for the next service run */
+        Ingress_Pop(&my->ingress);
+    }
+}
+
+static Ucs_Rm_Route_t *FindRoute(UCSI_Data_t *my, uint16_t routeId)
+{
+    UCSI_RouteIndex_t *idx = &my->routeIdx;
+    uint32_t mask = idx->size - 1;
+    uint32_t slot;
+    uint16_t entry;
+    if (NULL == idx->byId) return NULL;
+    for (slot = RouteIndex_HashId(routeId) & mask; 0 != (entry = idx->byId[slot]); slot = (slot + 1) & mask)
+    {
+        if (idx->routes[entry - 1].route_id == routeId)
+            return &idx->routes[entry - 1];
+    }
+    return NULL;
+}
+
+/* Returns index + 1 of the first route with this name, follow nameNext for the others. 0 if unknown. */
+static uint16_t FindRouteByName(UCSI_Data_t *my, const char *routeName)
+{
+    UCSI_RouteIndex_t *idx = &my->routeIdx;
+    uint32_t mask = idx->size - 1;
+    uint32_t slot;
+    uint16_t entry;
+    if (NULL == idx->byName) return 0;
+    for (slot = RouteIndex_HashName(routeName) & mask; 0 != (entry = idx->byName[slot]); slot = (slot + 1) & mask)
+    {
+        if (0 == strcmp(idx->names[entry - 1], routeName))
+            return entry;
+    }
+    return 0;
+}
+
+/* Switches every route of the given name, stops at the first failure */
+static Ucs_Return_t SetRoutesByName(UCSI_Data_t *my, const UnicensCmdRmSetRoute_t *cmd)
+{
+    Ucs_Return_t ret = UCS_RET_ERR_PARAM;
+    uint16_t entry;
+    for (entry = FindRouteByName(my, cmd->routeName); 0 != entry; entry = my->routeIdx.nameNext[entry - 1])
+    {
+        ret = Ucs_Rm_SetRouteActive(my->unicens, &my->routeIdx.routes[entry - 1], cmd->isActive);
+        if (UCS_RET_SUCCESS != ret)
+            break;
+        my->routeIdx.routes[entry - 1].active = cmd->isActive;
+    }
+    return ret;
+}
+
+/*
+ * Builds the lookup tables for the given route array. The tables are at least
+ * twice the amount of routes, so probe chains stay short. Duplicated IDs keep
+ * the first route, as the former linear search did.
+ */
+static bool RouteIndex_Build(UCSI_RouteIndex_t *idx, Ucs_Rm_Route_t *routes, const char **names, uint16_t count)
+{
+    uint32_t size = 8;
+    uint32_t mask, slot;
+    uint16_t i, entry;
+    free(idx->byId);
+    memset(idx, 0, sizeof(UCSI_RouteIndex_t));
+    if (NULL == routes || 0 == count)
+        return true;
+    while (size < 2 * (uint32_t)count)
+        size <<= 1;
+    /* one allocation for both tables and the name chains */
+    idx->byId = calloc(2 * size + count, sizeof(uint16_t));
+    if (NULL == idx->byId)
+        return false;
+    idx->byName = &idx->byId[size];
+    idx->nameNext = &idx->byId[2 * size];
+    idx->routes = routes;
+    idx->names = names;
+    idx->count = count;
+    idx->size = size;
+    mask = size - 1;
+    for (i = 0; i < count; i++)
+    {
+        for (slot = RouteIndex_HashId(routes[i].route_id) & mask; 0 != (entry = idx->byId[slot]); slot = (slot + 1) & mask)
+        {
+            if (routes[entry - 1].route_id == routes[i].route_id)
+                break;
+        }
+        if (0 == entry)
+            idx->byId[slot] = i + 1;
+        if (NULL == names || NULL == names[i])
+            continue;
+        for (slot = RouteIndex_HashName(names[i]) & mask; 0 != (entry = idx->byName[slot]); slot = (slot + 1) & mask)
+        {
+            if (0 == strcmp(names[entry - 1], names[i]))
+                break;
+        }
+        if (0 == entry)
+        {
+            idx->byName[slot] = i + 1;
+            continue;
+        }
+        /* append to the chain, so routes of one name are switched in configuration order */
+        while (0 != idx->nameNext[entry - 1])
+            entry = idx->nameNext[entry - 1];
+        idx->nameNext[entry - 1] = i + 1;
+    }
+    return true;
+}
+
+static uint32_t RouteIndex_HashId(uint16_t routeId)
+{
+    /* auto assigned IDs are consecutive, Fibonacci hashing spreads them */
+    return ((uint32_t)routeId * 2654435761u) >> 16;
+}
+
+static uint32_t RouteIndex_HashName(const char *routeName)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    while ('\0' != *routeName)
+    {
+        hash ^= (uint8_t)*routeName++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Dispatches every queued command that may run now.
+ * Init and Stop run alone: they start when no command is in flight, and no
+ * other lane starts anything until they finished. The other lanes are served
+ * by priority, except a lane whose oldest waiting command exceeded
+ * CMD_STARVATION_MS, which is served first.
+ */
+static void DispatchCommand(UCSI_Data_t *my)
+{
+    UCSI_Lane_t order[UCSI_LANE_COUNT];
+    bool starving[UCSI_LANE_COUNT];
+    uint8_t n = 0;
+    uint8_t i;
+    uint64_t now = UCSI_GetTimeUs(my);
+    uint64_t dueUs = 0;
+    uint64_t deadlineUs;
+    if (0 != my->inFlightCnt)
+        ExpireInFlight(my, now);
+    if (!DispatchLifecycle(my, now))
+        goto ArmTimer;
+    for (i = UCSI_Lane_Routing; i < UCSI_LANE_COUNT; i++)
+    {
+        starving[i] = IsLaneStarving(my, (UCSI_Lane_t)i, now);
+        if (starving[i])
+        {
+            my->laneStats[i].promoted++;
+            order[n++] = (UCSI_Lane_t)i;
+        }
+    }
+    for (i = UCSI_Lane_Routing; i < UCSI_LANE_COUNT; i++)
+    {
+        if (!starving[i])
+            order[n++] = (UCSI_Lane_t)i;
+    }
+    for (i = 0; i < n && my->inFlightCnt < CMD_MAX_IN_FLIGHT; i++)
+        DispatchLane(my, order[i], now, &dueUs);
+ArmTimer:
+    deadlineUs = NextDeadline(my);
+    if (0 != deadlineUs && (0 == dueUs || deadlineUs < dueUs))
+        dueUs = deadlineUs;
+    ArmCommandTimer(my, dueUs, now);
+}
+
+/* Runs Init and Stop, returns false while other lanes must not start anything */
+static bool DispatchLifecycle(UCSI_Data_t *my, uint64_t now)
+{
+    UCSI_Cmd_t *c;
+    while (NULL != (c = my->lanes[UCSI_Lane_Lifecycle].head))
+    {
+        if (c->inFlight || 0 != my->inFlightCnt)
+            return false;
+        switch (ExecuteCommand(my, c))
+        {
+        case UniCmdResult_OK_NeedToWaitForCB:
+            MarkInFlight(my, c, UCSI_Lane_Lifecycle, now);
+            return false;
+        case UniCmdResult_Retry:
+            return false;
+        default:
+            my->laneStats[UCSI_Lane_Lifecycle].dispatched++;
+            CmdList_Remove(my, c);
+            break;
+        }
+    }
+    return true;
+}
+
+static void MarkInFlight(UCSI_Data_t *my, UCSI_Cmd_t *c, UCSI_Lane_t lane, uint64_t now)
+{
+    uint32_t deadlineMs = CMD_DEADLINE_MS;
+    if (UCSI_Lane_Lifecycle == lane)
+        deadlineMs = CMD_INIT_DEADLINE_MS;
+    else if (UnicensCmd_I2CWrite == c->e.cmd)
+        deadlineMs += c->e.val.I2CWrite.timeout;
+    else if (UnicensCmd_NsRun == c->e.cmd)
+        deadlineMs += ScriptDeadlineMs(c->e.val.NsRun.node_ptr);
+    /* a new dispatch supersedes the expired ones, their results can not be told apart */
+    ForgetExpired(my, c->e.cmd, CommandDestination(&c->e));
+    c->inFlight = true;
+    c->dispatchedUs = now;
+    c->deadlineUs = now + ((uint64_t)deadlineMs * 1000);
+    my->inFlightCnt++;
+    if (UnicensCmd_NsRun == c->e.cmd)
+        my->scriptsInFlight++;
+    my->laneStats[lane].dispatched++;
+}
+
+/* Every step of a script may wait for its pause and a remote answer */
+static uint32_t ScriptDeadlineMs(const Ucs_Rm_Node_t *node)
+{
+    uint32_t ms = 0;
+    uint8_t i;
+    if (NULL == node || NULL == node->script_list_ptr)
+        return 0;
+    for (i = 0; i < node->script_list_size; i++)
+        ms += node->script_list_ptr[i].pause + CMD_SCRIPT_STEP_MS;
+    return ms;
+}
+
+/*
+ * Gives up in flight commands whose result did not arrive in time, so the
+ * queue keeps moving. Requesters are notified like for a processing error.
+ */
+static void ExpireInFlight(UCSI_Data_t *my, uint64_t now)
+{
+    UCSI_ExpiredCmd_t *x;
+    UCSI_NodeState_t *n;
+    UCSI_Cmd_t *c, *next;
+    bool initExpired = false;
+    uint16_t dest;
+    uint8_t lane;
+    for (lane = 0; lane < UCSI_LANE_COUNT; lane++)
+    {
+        for (c = my->lanes[lane].head; NULL != c; c = next)
+        {
+            next = c->next;
+            if (!c->inFlight || now < c->deadlineUs)
+                continue;
+            dest = CommandDestination(&c->e);
+            UCSI_CB_OnUserMessage(my->tag, true, "Command expired without result (cmd=0x%X, node=0x%X)", 2, c->e.cmd, dest);
+            my->poolStats.expired++;
+            x = &my->expired[my->expiredPos];
+            my->expiredPos = (my->expiredPos + 1) % CMD_MAX_IN_FLIGHT;
+            x->cmd = c->e.cmd;
+            x->nodeAddress = dest;
+            x->untilUs = now + ((uint64_t)CMD_INIT_DEADLINE_MS * 1000);
+            if (UnicensCmd_I2CWrite == c->e.cmd)
+                NotifyI2cWrite(my, c, NULL /*processing error*/);
+            if (UnicensCmd_NsRun == c->e.cmd && NULL != (n = NodeTable_Get(&my->nodeTable, dest, false)))
+                n->scriptState = UCSI_ScriptState_Failed;
+            if (UnicensCmd_Init == c->e.cmd)
+                initExpired = true;
+            CmdList_Remove(my, c);
+        }
+    }
+    /* same as a failed init result, restarting aborts commands so it waits for the loop's end */
+    if (initExpired)
+    {
+        my->initialized = false;
+        UCSI_CB_OnUserMessage(my->tag, true, "UcsInitResult did not arrive in time, restarting...", 0);
+        WarmRestart(my);
+    }
+}
+
+/* Earliest deadline of all in flight commands, 0 if none */
+static uint64_t NextDeadline(UCSI_Data_t *my)
+{
+    UCSI_Cmd_t *c;
+    uint64_t due = 0;
+    uint8_t lane;
+    if (0 == my->inFlightCnt)
+        return 0;
+    for (lane = 0; lane < UCSI_LANE_COUNT; lane++)
+    {
+        for (c = my->lanes[lane].head; NULL != c; c = c->next)
+        {
+            if (c->inFlight && (0 == due || c->deadlineUs < due))
+                due = c->deadlineUs;
+        }
+    }
+    return due;
+}
+
+/*
+ * true, if the result belongs to an expired command. Only asked when no matching
+ * command is in flight. The matching entry is consumed.
+ */
+static bool IsLateResult(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress)
+{
+    UCSI_ExpiredCmd_t *x;
+    uint64_t now = UCSI_GetTimeUs(my);
+    uint8_t i;
+    for (i = 0; i < CMD_MAX_IN_FLIGHT; i++)
+    {
+        x = &my->expired[i];
+        if (0 == x->untilUs || now > x->untilUs || x->cmd != cmd)
+            continue;
+        if (UCSI_Lane_Lifecycle != CommandLane(cmd) && x->nodeAddress != nodeAddress)
+            continue;
+        x->untilUs = 0;
+        my->poolStats.lateResults++;
+        UCSI_CB_OnUserMessage(my->tag, true, "Ignoring late result of expired command (cmd=0x%X, node=0x%X)", 2, cmd, nodeAddress);
+        return true;
+    }
+    return false;
+}
+
+/* Drops the expired entries of a node, UNICENS_CMD_COUNT matches every node command */
+static void ForgetExpired(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress)
+{
+    UCSI_ExpiredCmd_t *x;
+    uint8_t i;
+    for (i = 0; i < CMD_MAX_IN_FLIGHT; i++)
+    {
+        x = &my->expired[i];
+        if (0 == x->untilUs)
+            continue;
+        if (UNICENS_CMD_COUNT == cmd)
+        {
+            if (UCSI_Lane_Lifecycle == CommandLane(x->cmd) || x->nodeAddress != nodeAddress)
+                continue;
+        }
+        else if (x->cmd != cmd || (UCSI_Lane_Lifecycle != CommandLane(cmd) && x->nodeAddress != nodeAddress))
+            continue;
+        x->untilUs = 0;
+    }
+}
+
+/*
+ * Starts the commands of one lane. Commands to the same node keep their order,
+ * commands to different nodes run in parallel up to CMD_MAX_IN_FLIGHT.
+ * pDueUs is lowered to the time a held back command must be reconsidered.
+ */
+static void DispatchLane(UCSI_Data_t *my, UCSI_Lane_t lane, uint64_t now, uint64_t *pDueUs)
+{
+    uint16_t busy[CMD_MAX_NODES];
+    uint16_t busyCnt = 0;
+    uint16_t dest, i;
+    UCSI_Cmd_t *c, *next;
+    bool blocked, held, throttled;
+    for (c = my->lanes[lane].head; NULL != c && my->inFlightCnt < CMD_MAX_IN_FLIGHT; c = next)
+    {
+        dest = CommandDestination(&c->e);
+        blocked = false;
+        for (i = 0; i < busyCnt && !blocked; i++)
+            blocked = (busy[i] == dest);
+        /* more destinations than tracked: stay on the safe side and wait */
+        if (CMD_MAX_NODES == busyCnt && 0 != dest)
+            blocked = true;
+        /* a burst unlinks its followers, so look at the successor afterwards */
+        held = !c->inFlight && !blocked && HoldI2cBurst(my, c, now, pDueUs);
+        next = c->next;
+        /* scripts of different nodes run in parallel, up to the configured limit */
+        throttled = (UnicensCmd_NsRun == c->e.cmd && my->scriptsInFlight >= my->cmdCfg.maxScripts);
+        if (!c->inFlight && !blocked && !held && !throttled)
+        {
+            switch (ExecuteCommand(my, c))
+            {
+            case UniCmdResult_OK_NeedToWaitForCB:
+                MarkInFlight(my, c, lane, now);
+                break;
+            case UniCmdResult_Retry:
+                /* API locked by a running request, its completion triggers the next dispatch */
+                break;
+            case UniCmdResult_OK_ProcessFinished:
+                RecordLatency(my, c->e.cmd, c->e.submittedUs, now);
+                my->laneStats[lane].dispatched++;
+                CmdList_Remove(my, c);
+                continue;
+            default:
+                my->laneStats[lane].dispatched++;
+                CmdList_Remove(my, c);
+                continue;
+            }
+        }
+        /* later commands to the same node must wait for this one */
+        if (!blocked && 0 != dest && busyCnt < CMD_MAX_NODES)
+            busy[busyCnt++] = dest;
+    }
+}
+
+/*
+ * Collects the waiting single I2C writes to the same node and slave with the
+ * same length, which follow c in its lane, into one burst led by c. While the
+ * burst is not full and c is younger than I2C_BURST_WINDOW_MS, c is held back
+ * for more writes to arrive and true is returned.
+ */
+static bool HoldI2cBurst(UCSI_Data_t *my, UCSI_Cmd_t *c, uint64_t now, uint64_t *pDueUs)
+{
+    UnicensCmdI2CWrite_t *w = &c->e.val.I2CWrite;
+    UnicensCmdI2CWrite_t *fw;
+    UCSI_Cmd_t *f, *next;
+    UCSI_Cmd_t **tail;
+    uint16_t maxBlocks, blocks = 1;
+    uint64_t dueUs;
+    if (0 == I2C_BURST_WINDOW_MS || UnicensCmd_I2CWrite != c->e.cmd || w->isBurst || 0 == w->dataLen)
+        return false;
+    maxBlocks = I2C_WRITE_MAX_LEN / w->dataLen;
+    if (maxBlocks > I2C_BURST_MAX_BLOCKS)
+        maxBlocks = I2C_BURST_MAX_BLOCKS;
+    if (maxBlocks < 2)
+        return false;
+    /* only the writes directly following c for this node qualify, anything else ends the burst */
+    for (f = c->next; NULL != f && blocks < maxBlocks; f = f->next)
+    {
+        if (CommandDestination(&f->e) != w->destination)
+            continue;
+        fw = &f->e.val.I2CWrite;
+        if (UnicensCmd_I2CWrite != f->e.cmd || f->inFlight || fw->isBurst
+            || fw->slaveAddr != w->slaveAddr || fw->dataLen != w->dataLen)
+            break;
+        blocks++;
+    }
+    dueUs = c->enqueuedUs + ((uint64_t)I2C_BURST_WINDOW_MS * 1000);
+    if (blocks < maxBlocks && now < dueUs)
+    {
+        if (0 == *pDueUs || dueUs < *pDueUs)
+            *pDueUs = dueUs;
+        return true;
+    }
+    if (1 == blocks)
+        return false;
+    tail = &c->burstNext;
+    for (f = c->next, blocks = 1; NULL != f && blocks < maxBlocks; f = next)
+    {
+        next = f->next;
+        if (CommandDestination(&f->e) != w->destination)
+            continue;
+        fw = &f->e.val.I2CWrite;
+        if (UnicensCmd_I2CWrite != f->e.cmd || f->inFlight || fw->isBurst
+            || fw->slaveAddr != w->slaveAddr || fw->dataLen != w->dataLen)
+            break;
+        memcpy(&w->data[blocks * w->dataLen], fw->data, fw->dataLen);
+        if (fw->timeout > w->timeout)
+            w->timeout = fw->timeout;
+        CmdList_Unlink(my, f);
+        f->next = NULL;
+        *tail = f;
+        tail = &f->burstNext;
+        blocks++;
+    }
+    /* UNICENS expects the total length, made of blockCount blocks of equal size */
+    w->isBurst = true;
+    w->blockCount = (uint8_t)blocks;
+    w->dataLen = (uint8_t)(blocks * w->dataLen);
+    my->poolStats.i2cBursts++;
+    my->poolStats.i2cBurstMerged += blocks - 1;
+    return false;
+}
+
+/* Reports the result to the requester of an I2C write and to all writes folded into its burst */
+static void NotifyI2cWrite(UCSI_Data_t *my, UCSI_Cmd_t *c, void *result_ptr)
+{
+    UCSI_Cmd_t *f;
+    if (NULL != c->e.val.I2CWrite.result_fptr)
+        c->e.val.I2CWrite.result_fptr(result_ptr, c->e.val.I2CWrite.request_ptr);
+    while (NULL != (f = c->burstNext))
+    {
+        c->burstNext = f->burstNext;
+        if (NULL != result_ptr)
+            RecordLatency(my, f->e.cmd, f->e.submittedUs, c->dispatchedUs);
+        if (NULL != f->e.val.I2CWrite.result_fptr)
+            f->e.val.I2CWrite.result_fptr(result_ptr, f->e.val.I2CWrite.request_ptr);
+        CmdPool_Free(my, f);
+    }
+}
+
+/* Requests UCSI_CommandTimeout at dueUs, 0 cancels. The integrator is only called on changes. */
+static void ArmCommandTimer(UCSI_Data_t *my, uint64_t dueUs, uint64_t now)
+{
+    uint64_t ms = 1;
+    if (dueUs == my->cmdTimerDueUs)
+        return;
+    my->cmdTimerDueUs = dueUs;
+    if (0 != dueUs && dueUs > now)
+        ms = (dueUs - now + 999) / 1000;
+    if (ms > 0xFFFF)
+        ms = 0xFFFF;
+    UCSI_CB_OnSetCommandTimer(my->tag, (0 == dueUs) ? 0 : (uint16_t)ms);
+}
+
+static bool IsLaneStarving(UCSI_Data_t *my, UCSI_Lane_t lane, uint64_t now)
+{
+    UCSI_Cmd_t *c;
+    for (c = my->lanes[lane].head; NULL != c; c = c->next)
+    {
+        if (!c->inFlight)
+            return (now - c->enqueuedUs) > ((uint64_t)CMD_STARVATION_MS * 1000);
+    }
+    return false;
+}
+
+static UnicensCmdResult_t ExecuteCommand(UCSI_Data_t *my, UCSI_Cmd_t *c)
+{
+    UnicensCmdEntry_t *e = &c->e;
+    Ucs_Return_t ret;
+    Ucs_Rm_Route_t *route;
+    UnicensCmdResult_t result = UniCmdResult_OK_ProcessFinished;
     switch (e->cmd) {
         case UnicensCmd_Init:
-            if (UCS_RET_SUCCESS == Ucs_Init(my->unicens, e->val.Init.init_ptr, OnUcsInitResult))
-                popEntry = false;
+            ret = Ucs_Init(my->unicens, e->val.Init.init_ptr, OnUcsInitResult);
+            if (UCS_RET_SUCCESS == ret)
+                result = UniCmdResult_OK_NeedToWaitForCB;
             else
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Init failed", 0);
             break;
         case UnicensCmd_Stop:
-            if (UCS_RET_SUCCESS == Ucs_Stop(my->unicens, OnUcsStopResult))
-                popEntry = false;
+            ret = Ucs_Stop(my->unicens, OnUcsStopResult);
+            if (UCS_RET_SUCCESS == ret)
+                result = UniCmdResult_OK_NeedToWaitForCB;
             else
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Stop failed", 0);
             break;
         case UnicensCmd_RmSetRoute:
-            if (UCS_RET_SUCCESS != Ucs_Rm_SetRouteActive(my->unicens, e->val.RmSetRoute.routePtr, e->val.RmSetRoute.isActive))
+            if ('\0' != e->val.RmSetRoute.routeName[0]) {
+                if (0 == FindRouteByName(my, e->val.RmSetRoute.routeName)) {
+                    UCSI_CB_OnUserMessage(my->tag, true, "Unknown route, name=%s", 1, e->val.RmSetRoute.routeName);
+                    ret = UCS_RET_ERR_PARAM;
+                }
+                else if (UCS_RET_SUCCESS != (ret = SetRoutesByName(my, &e->val.RmSetRoute))
+                    && UCS_RET_ERR_API_LOCKED != ret)
+                    UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Rm_SetRouteActive failed", 0);
+                break;
+            }
+            route = FindRoute(my, e->val.RmSetRoute.routeId);
+            ret = UCS_RET_ERR_PARAM;
+            if (NULL == route)
+                UCSI_CB_OnUserMessage(my->tag, true, "Unknown route, id=0x%X", 1, e->val.RmSetRoute.routeId);
+            else if (UCS_RET_SUCCESS != (ret = Ucs_Rm_SetRouteActive(my->unicens, route, e->val.RmSetRoute.isActive))
+                && UCS_RET_ERR_API_LOCKED != ret)
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Rm_SetRouteActive failed", 0);
+            /* remembered in the route, so a restart builds it again */
+            if (UCS_RET_SUCCESS == ret)
+                route->active = e->val.RmSetRoute.isActive;
             break;
         case UnicensCmd_NsRun:
-            if (UCS_RET_SUCCESS != Ucs_Ns_Run(my->unicens, e->val.NsRun.node_ptr, OnUcsNsRun))
+            ret = Ucs_Ns_Run(my->unicens, e->val.NsRun.node_ptr, OnUcsNsRun);
+            if (UCS_RET_SUCCESS == ret)
+                result = UniCmdResult_OK_NeedToWaitForCB;
+            else if (UCS_RET_ERR_API_LOCKED != ret)
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Ns_Run failed", 0);
             break;
         case UnicensCmd_GpioCreatePort:
-            if (UCS_RET_SUCCESS == Ucs_Gpio_CreatePort(my->unicens, e->val.GpioCreatePort.destination, 0, e->val.GpioCreatePort.debounceTime, OnUcsGpioPortCreate))
-                popEntry = false;
-            else
+            ret = Ucs_Gpio_CreatePort(my->unicens, e->val.GpioCreatePort.destination, 0, e->val.GpioCreatePort.debounceTime, OnUcsGpioPortCreate);
+            if (UCS_RET_SUCCESS == ret)
+                result = UniCmdResult_OK_NeedToWaitForCB;
+            else if (UCS_RET_ERR_API_LOCKED != ret)
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_Gpio_CreatePort failed", 0);
             break;
         case UnicensCmd_GpioWritePort:
-            if (UCS_RET_SUCCESS == Ucs_Gpio_WritePort(my->unicens, e->val.GpioWritePort.destination, 0x1D00, e->val.GpioWritePort.mask, e->val.GpioWritePort.data, OnUcsGpioPortWrite))
-                popEntry = false;
-            else
+            ret = Ucs_Gpio_WritePort(my->unicens, e->val.GpioWritePort.destination, 0x1D00, e->val.GpioWritePort.mask, e->val.GpioWritePort.data, OnUcsGpioPortWrite);
+            if (UCS_RET_SUCCESS == ret)
+                result = UniCmdResult_OK_NeedToWaitForCB;
+            else if (UCS_RET_ERR_API_LOCKED != ret)
                 UCSI_CB_OnUserMessage(my->tag, true, "UnicensCmd_GpioWritePort failed", 0);
             break;
         case UnicensCmd_I2CWrite:
@@ -224,237 +1325,464 @@ void UCSI_Service(UCSI_Data_t *my)
                 (e->val.I2CWrite.isBurst ? UCS_I2C_BURST_MODE : UCS_I2C_DEFAULT_MODE), e->val.I2CWrite.blockCount,
                 e->val.I2CWrite.slaveAddr, e->val.I2CWrite.timeout, e->val.I2CWrite.dataLen, e->val.I2CWrite.data, OnUcsI2CWrite);
             if (UCS_RET_SUCCESS == ret)
-                popEntry = false;
-            else {
+                result = UniCmdResult_OK_NeedToWaitForCB;
+            else if (UCS_RET_ERR_API_LOCKED != ret) {
                 UCSI_CB_OnUserMessage(my->tag, true, "Ucs_I2c_WritePort failed ret=%d", 1, ret);
                 assert(e->val.I2CWrite.result_fptr != NULL);
-                e->val.I2CWrite.result_fptr(NULL /*processing error*/, e->val.I2CWrite.request_ptr);
+                NotifyI2cWrite(my, c, NULL /*processing error*/);
             }
             break;
         default:
             assert(false);
-            break;
+            return UniCmdResult_ERROR_ProcessFinished;
+    }
+    if (UCS_RET_ERR_API_LOCKED == ret)
+        return UniCmdResult_Retry;
+    if (UCS_RET_SUCCESS != ret)
+        return UniCmdResult_ERROR_ProcessFinished;
+    return result;
+}
+
+/* Node address a command is ordered by, 0 if it does not target a single node */
+static uint16_t CommandDestination(const UnicensCmdEntry_t *e)
+{
+    switch (e->cmd) {
+        case UnicensCmd_NsRun:
+            return e->val.NsRun.node_ptr->signature_ptr->node_address;
+        case UnicensCmd_GpioCreatePort:
+            return e->val.GpioCreatePort.destination;
+        case UnicensCmd_GpioWritePort:
+            return e->val.GpioWritePort.destination;
+        case UnicensCmd_I2CWrite:
+            return e->val.I2CWrite.destination;
+        default:
+            return 0;
     }
-    if (popEntry)
+}
+
+static UCSI_Lane_t CommandLane(UnicensCmd_t cmd)
+{
+    switch (cmd) {
+        case UnicensCmd_Init:
+        case UnicensCmd_Stop:
+            return UCSI_Lane_Lifecycle;
+        case UnicensCmd_RmSetRoute:
+            return UCSI_Lane_Routing;
+        case UnicensCmd_GpioCreatePort:
+        case UnicensCmd_GpioWritePort:
+            return UCSI_Lane_Gpio;
+        default:
+            return UCSI_Lane_Bulk;
+    }
+}
+
+static UCSI_Cmd_t *FindInFlight(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress)
+{
+    UCSI_Cmd_t *c;
+    UCSI_Lane_t lane = CommandLane(cmd);
+    for (c = my->lanes[lane].head; NULL != c; c = c->next)
     {
-        my->currentCmd = NULL;
-        RB_PopReadPtr(&my->rb);
+        if (!c->inFlight || c->e.cmd != cmd)
+            continue;
+        if (UCSI_Lane_Lifecycle == lane || CommandDestination(&c->e) == nodeAddress)
+            return c;
     }
+    return NULL;
 }
 
-void UCSI_Timeout(UCSI_Data_t *my)
+/* UNICENS terminated, pending results will never be reported */
+static void AbortInFlight(UCSI_Data_t *my)
 {
-    assert(MAGIC == my->magic);
-    if (NULL == my->unicens) return;
-    Ucs_ReportTimeout(my->unicens);
+    UCSI_Cmd_t *c, *next;
+    uint8_t lane;
+    for (lane = 0; lane < UCSI_LANE_COUNT; lane++)
+    {
+        for (c = my->lanes[lane].head; NULL != c; c = next)
+        {
+            next = c->next;
+            if (!c->inFlight)
+                continue;
+            if (UnicensCmd_I2CWrite == c->e.cmd)
+                NotifyI2cWrite(my, c, NULL /*processing error*/);
+            CmdList_Remove(my, c);
+        }
+    }
 }
 
-bool UCSI_SendAmsMessage(UCSI_Data_t *my, uint16_t msgId, uint16_t targetAddress, uint8_t *pPayload, uint32_t payloadLen)
+/*
+ * Restarts UNICENS with the configuration already loaded. Routes come back in
+ * the state last requested, as their active flag is kept in the route objects.
+ * Nodes keep a succeeded script, so it is only run again if the node drops
+ * out in between. Without ENABLE_WARM_RESTART every node is scripted again.
+ */
+static void WarmRestart(UCSI_Data_t *my)
 {
-    Ucs_AmsTx_Msg_t *msg;
-    Ucs_Return_t result;
-    assert(MAGIC == my->magic);
-    if (NULL == my->unicens) return false;
-    msg = Ucs_AmsTx_AllocMsg(my->unicens, payloadLen);
-    if (NULL == msg) return false;
-    if (0 != payloadLen)
+    UnicensCmdEntry_t e;
+    UCSI_NodeState_t *n;
+    uint16_t i;
+    AbortInFlight(my);
+    for (i = 0; i < my->nodeTable.count; i++)
     {
-        assert(NULL != msg->data_ptr);
-        memcpy(msg->data_ptr, pPayload, payloadLen);
+        n = &my->nodeTable.nodes[i];
+        n->available = false;
+        n->gpioPortHandle = 0;
+        n->i2cPortHandle = 0;
+        if (!ENABLE_WARM_RESTART || UCSI_ScriptState_Succeeded != n->scriptState)
+            n->scriptState = UCSI_ScriptState_None;
     }
-    msg->custom_info_ptr = NULL;
-    msg->data_size = payloadLen;
-    msg->destination_address = targetAddress;
-    msg->llrbc = 10;
-    msg->msg_id = msgId;
-    result = Ucs_AmsTx_SendMsg(my->unicens, msg, NULL);
-    if (UCS_RET_SUCCESS != result)
-        Ucs_AmsTx_FreeUnusedMsg(my->unicens, msg);
-    return UCS_RET_SUCCESS == result;
+    for (i = 0; i < my->routeIdx.count; i++)
+    {
+        if (my->routeIdx.routes[i].active)
+            my->restartStats.routesRestored++;
+    }
+    my->restartStats.warm++;
+    e.cmd = UnicensCmd_Init;
+    e.val.Init.init_ptr = &my->uniInitData;
+    EnqueueCommand(my, &e);
 }
 
-bool UCSI_GetAmsMessage(UCSI_Data_t *my, uint16_t *pMsgId, uint16_t *pSourceAddress, uint8_t **pPayload, uint32_t *pPayloadLen)
+static void OnCommandExecuted(UCSI_Data_t *my, UnicensCmd_t cmd, uint16_t nodeAddress)
 {
-    Ucs_AmsRx_Msg_t *msg;
-    assert(MAGIC == my->magic);
-    if (NULL == my->unicens || NULL == pPayload || NULL == pPayloadLen) return false;
-    msg = Ucs_AmsRx_PeekMsg(my->unicens);
-    if (NULL == msg) return false;
-    *pMsgId = msg->msg_id;
-    *pSourceAddress = msg->source_address;
-    *pPayload = msg->data_ptr;
-    *pPayloadLen = msg->data_size;
-    return true;
+    UCSI_Cmd_t *c;
+    if (NULL == my)
+    {
+        assert(false);
+        return;
+    }
+    c = FindInFlight(my, cmd, nodeAddress);
+    if (NULL == c && IsLateResult(my, cmd, nodeAddress))
+        return;
+    if (NULL == c)
+    {
+        /* may happen for results arriving after AbortInFlight */
+        UCSI_CB_OnUserMessage(my->tag, true, "OnUniCommandExecuted was called, but no "\
+            "matching command is in flight (cmd=0x%X, node=0x%X)", 2, cmd, nodeAddress);
+        return;
+    }
+    RecordLatency(my, cmd, c->e.submittedUs, c->dispatchedUs);
+    CmdList_Remove(my, c);
 }
 
-void UCSI_ReleaseAmsMessage(UCSI_Data_t *my)
+/* Cheap enough to stay enabled: two bucket increments per finished command */
+static void RecordLatency(UCSI_Data_t *my, UnicensCmd_t cmd, uint64_t submittedUs, uint64_t dispatchedUs)
 {
-    assert(MAGIC == my->magic);
-    if (NULL == my->unicens) return;
-    Ucs_AmsRx_ReleaseMsg(my->unicens);
+    if (cmd >= UNICENS_CMD_COUNT)
+        return;
+    LatencyHisto_Add(&my->latency[cmd].wait, submittedUs, dispatchedUs);
+    LatencyHisto_Add(&my->latency[cmd].exec, dispatchedUs, UCSI_GetTimeUs(my));
 }
 
-bool UCSI_SetRouteActive(UCSI_Data_t *my, uint16_t routeId, bool isActive)
+static void LatencyHisto_Add(UCSI_LatencyHisto_t *h, uint64_t startUs, uint64_t endUs)
 {
+    /* submit times of other threads may be a little ahead of the cached service time */
+    uint64_t us = (endUs > startUs) ? (endUs - startUs) : 0;
+    uint8_t bucket = (0 == us) ? 0 : (uint8_t)(64 - __builtin_clzll(us));
+    if (bucket >= LATENCY_HISTO_LEN)
+        bucket = LATENCY_HISTO_LEN - 1;
+    h->histo[bucket]++;
+    h->count++;
+    h->totalUs += us;
+    if (us > h->maxUs)
+        h->maxUs = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+}
+
+/* Starts over with the nodes of a new configuration, they are reported not available until the manager finds them */
+static void NodeTable_Load(UCSI_NodeTable_t *t, Ucs_Rm_Node_t *nodes, const bool *gpio, uint16_t count)
+{
+    UCSI_NodeState_t *n;
     uint16_t i;
-    UnicensCmdEntry_t entry;
-    assert(MAGIC == my->magic);
-    if (NULL == my || NULL == my->uniInitData.mgr.routes_list_ptr) return false;
-    for (i = 0; i < my->uniInitData.mgr.routes_list_size; i++)
+    memset(t, 0, sizeof(UCSI_NodeTable_t));
+    for (i = 0; NULL != nodes && i < count; i++)
     {
-        Ucs_Rm_Route_t *route = &my->uniInitData.mgr.routes_list_ptr[i];
-        if (route->route_id != routeId)
+        if (NULL == nodes[i].signature_ptr)
+            continue;
+        n = NodeTable_Get(t, nodes[i].signature_ptr->node_address, true);
+        if (NULL == n)
             continue;
-        entry.cmd = UnicensCmd_RmSetRoute;
-        entry.val.RmSetRoute.routePtr = route;
-        entry.val.RmSetRoute.isActive = isActive;
-        return EnqueueCommand(my, &entry);
+        n->node = &nodes[i];
+        n->gpioEager = (NULL != gpio && gpio[i]);
     }
-    return false;
 }
 
-bool UCSI_I2CWrite(UCSI_Data_t *my, uint16_t targetAddress, bool isBurst, uint8_t blockCount,
-    uint8_t slaveAddr, uint16_t timeout, uint8_t dataLen, uint8_t *pData, 
-    Ucsi_ResultCb_t result_fptr, void *request_ptr)
+static UCSI_NodeState_t *NodeTable_Get(UCSI_NodeTable_t *t, uint16_t nodeAddress, bool create)
 {
-    UnicensCmdEntry_t entry;
-    assert(MAGIC == my->magic);
-    if (NULL == my || NULL == pData || 0 == dataLen) return false;
-    if (dataLen > I2C_WRITE_MAX_LEN) return false;
-    entry.cmd = UnicensCmd_I2CWrite;
-    entry.val.I2CWrite.destination = targetAddress;
-    entry.val.I2CWrite.isBurst = isBurst;
-    entry.val.I2CWrite.blockCount = blockCount;
-    entry.val.I2CWrite.slaveAddr = slaveAddr;
-    entry.val.I2CWrite.timeout = timeout;
-    entry.val.I2CWrite.dataLen = dataLen;
-    entry.val.I2CWrite.result_fptr = result_fptr;
-    entry.val.I2CWrite.request_ptr = request_ptr;
-    memcpy(entry.val.I2CWrite.data, pData, dataLen);
-    return EnqueueCommand(my, &entry);
+    UCSI_NodeState_t *n;
+    uint32_t mask = NODE_HASH_LEN - 1;
+    uint32_t slot;
+    /* Fibonacci hashing as for route IDs, at most half of the slots are ever used */
+    for (slot = (((uint32_t)nodeAddress * 2654435761u) >> 16) & mask; 0 != t->byAddress[slot]; slot = (slot + 1) & mask)
+    {
+        if (t->nodes[t->byAddress[slot] - 1].nodeAddress == nodeAddress)
+            return &t->nodes[t->byAddress[slot] - 1];
+    }
+    if (!create || t->count >= UCS_NUM_REMOTE_DEVICES)
+        return NULL;
+    n = &t->nodes[t->count++];
+    memset(n, 0, sizeof(UCSI_NodeState_t));
+    n->nodeAddress = nodeAddress;
+    t->byAddress[slot] = t->count;
+    return n;
 }
 
-bool UCSI_SetGpioState(UCSI_Data_t *my, uint16_t targetAddress, uint8_t gpioPinId, bool isHighState)
+/*
+ * Hashes the node address and everything sent and expected by the scripts.
+ * Pointers are followed, so an equal script loaded again gets the same value.
+ */
+static uint32_t ScriptFingerprint(const Ucs_Rm_Node_t *node)
 {
-    uint16_t mask;
-    UnicensCmdEntry_t entry;
-    assert(MAGIC == my->magic);
-    if (NULL == my) return false;
-    mask = 1 << gpioPinId;
-    entry.cmd = UnicensCmd_GpioWritePort;
-    entry.val.GpioWritePort.destination = targetAddress;
-    entry.val.GpioWritePort.mask = mask;
-    entry.val.GpioWritePort.data = isHighState ? mask : 0;
-    return EnqueueCommand(my, &entry);
+    const Ucs_Ns_Script_t *s;
+    const Ucs_Ns_ConfigMsg_t *m;
+    uint32_t hash = 2166136261u;
+    uint8_t i, j;
+    if (NULL == node || NULL == node->signature_ptr)
+        return 0;
+    hash = Fnv1a(hash, &node->signature_ptr->node_address, sizeof(node->signature_ptr->node_address));
+    for (i = 0; NULL != node->script_list_ptr && i < node->script_list_size; i++)
+    {
+        s = &node->script_list_ptr[i];
+        hash = Fnv1a(hash, &s->pause, sizeof(s->pause));
+        for (j = 0; j < 2; j++)
+        {
+            m = (0 == j) ? s->send_cmd : s->exp_result;
+            if (NULL == m)
+                continue;
+            hash = Fnv1a(hash, &m->FBlockId, sizeof(m->FBlockId));
+            hash = Fnv1a(hash, &m->InstId, sizeof(m->InstId));
+            hash = Fnv1a(hash, &m->FunktId, sizeof(m->FunktId));
+            hash = Fnv1a(hash, &m->OpCode, sizeof(m->OpCode));
+            hash = Fnv1a(hash, &m->DataLen, sizeof(m->DataLen));
+            if (NULL != m->DataPtr)
+                hash = Fnv1a(hash, m->DataPtr, m->DataLen);
+        }
+    }
+    /* 0 is reserved for no fingerprint */
+    return (0 == hash) ? 1 : hash;
 }
 
-/************************************************************************/
-/* Private Functions                                                    */
-/************************************************************************/
-static bool EnqueueCommand(UCSI_Data_t *my, UnicensCmdEntry_t *cmd)
+static uint32_t Fnv1a(uint32_t hash, const void *data, uint32_t len)
 {
-    UnicensCmdEntry_t *e;
-    if (NULL == my || NULL == cmd)
+    const uint8_t *p = (const uint8_t *)data;
+    while (0 != len--)
     {
-        assert(false);
-        return false;
+        hash ^= *p++;
+        hash *= 16777619u;
     }
-    e = RB_GetWritePtr(&my->rb);
-    if (NULL == e)
+    return hash;
+}
+
+static void CmdPool_Init(UCSI_Data_t *my, const UCSI_CmdQueueCfg_t *pCfg)
+{
+    my->cmdCfg.capacity = CMD_QUEUE_LEN;
+    my->cmdCfg.maxCapacity = CMD_QUEUE_MAX_LEN;
+    my->cmdCfg.policy = UCSI_QueuePolicy_Reject;
+    if (NULL != pCfg)
+        memcpy(&my->cmdCfg, pCfg, sizeof(UCSI_CmdQueueCfg_t));
+    if (my->cmdCfg.maxCapacity < my->cmdCfg.capacity)
+        my->cmdCfg.maxCapacity = my->cmdCfg.capacity;
+    if (0 == my->cmdCfg.maxScripts)
+        my->cmdCfg.maxScripts = CMD_MAX_SCRIPTS;
+    my->cmdFree = NULL;
+    memset(&my->poolStats, 0, sizeof(my->poolStats));
+    memset(my->lanes, 0, sizeof(my->lanes));
+    memset(my->laneStats, 0, sizeof(my->laneStats));
+    my->inFlightCnt = 0;
+    my->scriptsInFlight = 0;
+    my->cmdTimerDueUs = 0;
+    if (!CmdPool_Grow(my, my->cmdCfg.capacity))
     {
-        UCSI_CB_OnUserMessage(my->tag, true, "Could not enqueue command. Increase CMD_QUEUE_LEN define", 0);
-        return false;
+        UCSI_CB_OnUserMessage(my->tag, true, "Can not allocate command pool (capacity=%d)", 1, my->cmdCfg.capacity);
+        assert(false);
     }
-    memcpy(e, cmd, sizeof(UnicensCmdEntry_t));
-    RB_PopWritePtr(&my->rb);
-    UCSI_CB_OnServiceRequired(my->tag);
-    return true;
 }
 
-static void OnCommandExecuted(UCSI_Data_t *my, UnicensCmd_t cmd)
+/* Adds a chunk of commands to the free list, chunks stay allocated for the lifetime of the instance */
+static bool CmdPool_Grow(UCSI_Data_t *my, uint16_t amount)
 {
-    if (NULL == my)
+    uint16_t i;
+    UCSI_Cmd_t *chunk;
+    if (0 == amount) return false;
+    chunk = calloc(amount, sizeof(UCSI_Cmd_t));
+    if (NULL == chunk) return false;
+    for (i = 0; i < amount; i++)
     {
-        assert(false);
-        return;
+        chunk[i].next = my->cmdFree;
+        my->cmdFree = &chunk[i];
     }
-    if (NULL == my->currentCmd)
+    my->poolStats.capacity += amount;
+    return true;
+}
+
+static bool CmdPool_HasRoom(UCSI_Data_t *my)
+{
+    return (NULL != my->cmdFree || my->poolStats.capacity < my->cmdCfg.maxCapacity);
+}
+
+static UCSI_Cmd_t *CmdPool_Alloc(UCSI_Data_t *my)
+{
+    UCSI_Cmd_t *c;
+    uint16_t amount;
+    if (NULL == my->cmdFree && my->poolStats.capacity < my->cmdCfg.maxCapacity)
     {
-        UCSI_CB_OnUserMessage(my->tag, true, "OnUniCommandExecuted was called, but no "\
-            "command is in queue", 0);
-        assert(false);
-        return;
+        amount = my->cmdCfg.maxCapacity - my->poolStats.capacity;
+        if (amount > CMD_QUEUE_GROW_LEN)
+            amount = CMD_QUEUE_GROW_LEN;
+        if (CmdPool_Grow(my, amount))
+            my->poolStats.grown++;
     }
-    if (my->currentCmd->cmd != cmd)
+    c = my->cmdFree;
+    if (NULL == c) return NULL;
+    my->cmdFree = c->next;
+    c->inFlight = false;
+    c->next = NULL;
+    c->burstNext = NULL;
+    if (++my->poolStats.used > my->poolStats.highWater)
+        my->poolStats.highWater = my->poolStats.used;
+    return c;
+}
+
+/* Queues the command at the end of its priority lane */
+static void CmdList_Append(UCSI_Data_t *my, UCSI_Cmd_t *c)
+{
+    UCSI_Lane_t lane = CommandLane(c->e.cmd);
+    UCSI_CmdList_t *list = &my->lanes[lane];
+    UCSI_LaneStats_t *stats = &my->laneStats[lane];
+    c->next = NULL;
+    c->enqueuedUs = UCSI_GetTimeUs(my);
+    if (NULL == list->tail)
+        list->head = c;
+    else
+        list->tail->next = c;
+    list->tail = c;
+    if (++stats->depth > stats->maxDepth)
+        stats->maxDepth = stats->depth;
+}
+
+/* Unlinks the command from the queue and gives it back to the pool */
+static void CmdList_Remove(UCSI_Data_t *my, UCSI_Cmd_t *c)
+{
+    /* writes of a burst must have been notified before */
+    assert(NULL == c->burstNext);
+    CmdList_Unlink(my, c);
+    CmdPool_Free(my, c);
+}
+
+/* Unlinks the command from the queue, it stays allocated */
+static void CmdList_Unlink(UCSI_Data_t *my, UCSI_Cmd_t *c)
+{
+    UCSI_Lane_t lane = CommandLane(c->e.cmd);
+    UCSI_CmdList_t *list = &my->lanes[lane];
+    UCSI_Cmd_t *prev = NULL;
+    UCSI_Cmd_t *it;
+    for (it = list->head; NULL != it && it != c; it = it->next)
+        prev = it;
+    assert(NULL != it);
+    if (NULL == it) return;
+    if (NULL == prev)
+        list->head = c->next;
+    else
+        prev->next = c->next;
+    if (list->tail == c)
+        list->tail = prev;
+    my->laneStats[lane].depth--;
+    if (c->inFlight)
     {
-        UCSI_CB_OnUserMessage(my->tag, true, "OnUniCommandExecuted was called with "\
-            "wrong command (Expected=0x%X, Got=0x%X", 2, my->currentCmd->cmd, cmd);
-        assert(false);
-        return;
+        my->inFlightCnt--;
+        if (UnicensCmd_NsRun == c->e.cmd)
+            my->scriptsInFlight--;
     }
-    my->currentCmd = NULL;
-    RB_PopReadPtr(&my->rb);
+    c->inFlight = false;
 }
 
-static void RB_Init(RB_t *rb, uint16_t amountOfEntries, uint32_t sizeOfEntry, uint8_t *workingBuffer)
+static void CmdPool_Free(UCSI_Data_t *my, UCSI_Cmd_t *c)
 {
-    assert(NULL != rb);
-    assert(NULL != workingBuffer);
-    rb->dataQueue = workingBuffer;
-    rb->pRx = rb->dataQueue;
-    rb->pTx = rb->dataQueue;
-    rb->amountOfEntries = amountOfEntries;
-    rb->sizeOfEntry = sizeOfEntry;
-    rb->rxPos = 0;
-    rb->txPos = 0;
+    c->inFlight = false;
+    c->next = my->cmdFree;
+    my->cmdFree = c;
+    my->poolStats.used--;
 }
 
-static void *RB_GetReadPtr(RB_t *rb)
+static void Ingress_Init(UCSI_Ingress_t *q)
 {
-    assert(NULL != rb);
-    assert(0 != rb->dataQueue);
-    if (rb->txPos - rb->rxPos > 0)
-    return (void *)rb->pRx;
-    return NULL;
+    uint32_t i;
+    assert(NULL != q);
+    assert(0 == (CMD_INGRESS_LEN & (CMD_INGRESS_LEN - 1)));
+    for (i = 0; i < CMD_INGRESS_LEN; i++)
+        atomic_init(&q->cells[i].sequence, i);
+    atomic_init(&q->enqueuePos, 0);
+    atomic_init(&q->rejected, 0);
+    q->dequeuePos = 0;
+}
+
+static bool Ingress_Push(UCSI_Ingress_t *q, const UnicensCmdEntry_t *cmd)
+{
+    UCSI_IngressCell_t *cell;
+    unsigned int pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+    for (;;)
+    {
+        int diff;
+        cell = &q->cells[pos & (CMD_INGRESS_LEN - 1)];
+        diff = (int)(atomic_load_explicit(&cell->sequence, memory_order_acquire) - pos);
+        if (0 == diff)
+        {
+            /* slot is free, claim it (pos is reloaded on failure) */
+            if (atomic_compare_exchange_weak_explicit(&q->enqueuePos, &pos, pos + 1,
+                memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false; /* consumer did not free the slot yet, queue is full */
+        }
+        else
+        {
+            pos = atomic_load_explicit(&q->enqueuePos, memory_order_relaxed);
+        }
+    }
+    memcpy(&cell->entry, cmd, sizeof(UnicensCmdEntry_t));
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return true;
 }
 
-static void RB_PopReadPtr(RB_t *rb)
+static UnicensCmdEntry_t *Ingress_Peek(UCSI_Ingress_t *q)
 {
-    assert(NULL != rb);
-    assert(0 != rb->dataQueue);
+    UCSI_IngressCell_t *cell = &q->cells[q->dequeuePos & (CMD_INGRESS_LEN - 1)];
+    unsigned int seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if ((int)(seq - (q->dequeuePos + 1)) < 0)
+        return NULL; /* empty or producer still copying */
+    return &cell->entry;
+}
 
-    rb->pRx += rb->sizeOfEntry;
-    if (rb->pRx >= rb->dataQueue + ( rb->amountOfEntries * rb->sizeOfEntry))
-    rb->pRx = rb->dataQueue;
-    ++rb->rxPos;
-    assert(rb->txPos >= rb->rxPos);
+static void Ingress_Pop(UCSI_Ingress_t *q)
+{
+    UCSI_IngressCell_t *cell = &q->cells[q->dequeuePos & (CMD_INGRESS_LEN - 1)];
+    /* hand the slot back to producers for the next lap */
+    atomic_store_explicit(&cell->sequence, q->dequeuePos + CMD_INGRESS_LEN, memory_order_release);
+    q->dequeuePos++;
 }
 
-static void *RB_GetWritePtr(RB_t *rb)
+static void TimeCacheBegin(UCSI_Data_t *my)
 {
-    assert(NULL != rb);
-    assert(0 != rb->dataQueue);
-    if (rb->txPos - rb->rxPos < rb->amountOfEntries)
-    return (void *)rb->pTx;
-    return NULL;
+    /* Read the clock once per pass, UNICENS queries the tick very often */
+    my->time.cachedUs = UCSI_CB_OnGetTime(my->tag);
+    my->time.cacheValid = true;
 }
 
-static void RB_PopWritePtr(RB_t *rb)
+static void TimeCacheEnd(UCSI_Data_t *my)
 {
-    assert(NULL != rb);
-    assert(0 != rb->dataQueue);
-    rb->pTx += rb->sizeOfEntry;
-    if (rb->pTx >= rb->dataQueue + ( rb->amountOfEntries * rb->sizeOfEntry))
-    rb->pTx = rb->dataQueue;
-    ++rb->txPos;
-    assert(rb->txPos >= rb->rxPos);
+    my->time.cacheValid = false;
 }
 
 static uint16_t OnUnicensGetTime(void *user_ptr)
 {
+    uint64_t ms;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
-    return UCSI_CB_OnGetTime(my->tag);
+    /* UNICENS works with a 16 bit millisecond tick, derived from the 64 bit time base.
+       The tick wraps every 65.536 seconds, the upper bits count the wrap arounds. */
+    ms = UCSI_GetTimeUs(my) / 1000;
+    my->time.lastTick = (uint16_t)ms;
+    my->time.wraps = (uint32_t)(ms >> 16);
+    return my->time.lastTick;
 }
 
 static void OnUnicensService( void *user_ptr )
@@ -462,19 +1790,17 @@ static void OnUnicensService( void *user_ptr )
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
     my->triggerService = true;
-    UCSI_CB_OnServiceRequired(my->tag);
+    if (!my->rxBatchActive)
+        UCSI_CB_OnServiceRequired(my->tag);
 }
 
 static void OnUnicensError( Ucs_Error_t error_code, void *user_ptr )
 {
-    UnicensCmdEntry_t e;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     error_code = error_code;
     assert(MAGIC == my->magic);
     UCSI_CB_OnUserMessage(my->tag, true, "UNICENS general error, code=0x%X, restarting", 1, error_code);
-    e.cmd = UnicensCmd_Init;
-    e.val.Init.init_ptr = &my->uniInitData;
-    EnqueueCommand(my, &e);
+    WarmRestart(my);
 }
 
 static void OnUnicensAppTimer( uint16_t timeout, void *user_ptr )
@@ -508,12 +1834,19 @@ static void OnLldCtrlStart( Ucs_Lld_Api_t* api_ptr, void *inst_ptr, void *lld_us
     assert(MAGIC == my->magic);
     my->uniLld = api_ptr;
     my->uniLldHPtr = inst_ptr;
+    if (my->rxStarved)
+    {
+        my->rxStarved = false;
+        UCSI_CB_OnRxBufferAvailable(my->tag);
+    }
 }
 
 static void OnLldCtrlStop( void *lld_user_ptr )
 {
     UCSI_Data_t *my = (UCSI_Data_t *)lld_user_ptr;
     assert(MAGIC == my->magic);
+    /* pending telegrams must be released while the LLD API is still valid */
+    UCSI_CB_OnTxStop(my->tag);
     my->uniLld = NULL;
     my->uniLldHPtr = NULL;
 }
@@ -522,6 +1855,11 @@ static void OnLldCtrlRxMsgAvailable( void *lld_user_ptr )
 {
     UCSI_Data_t *my = (UCSI_Data_t *)lld_user_ptr;
     assert(MAGIC == my->magic);
+    if (my->rxStarved)
+    {
+        my->rxStarved = false;
+        UCSI_CB_OnRxBufferAvailable(my->tag);
+    }
     UCSI_CB_OnServiceRequired(my->tag);
 }
 
@@ -529,8 +1867,8 @@ static void OnLldCtrlTxTransmitC( Ucs_Lld_TxMsg_t *msg_ptr, void *lld_user_ptr )
 {
     UCSI_Data_t *my;
     Ucs_Mem_Buffer_t * buf_ptr;
-    uint8_t buffer[BOARD_PMS_TX_SIZE];
-    uint32_t bufferPos = 0;
+    struct iovec iov[TX_MAX_SEGMENTS];
+    int iovCnt = 0;
     my = (UCSI_Data_t *)lld_user_ptr;
     assert(MAGIC == my->magic);
     if (NULL == msg_ptr || NULL == my || NULL == my->uniLld || NULL == my->uniLldHPtr)
@@ -540,19 +1878,21 @@ static void OnLldCtrlTxTransmitC( Ucs_Lld_TxMsg_t *msg_ptr, void *lld_user_ptr )
     }
     for (buf_ptr = msg_ptr->memory_ptr; buf_ptr != NULL; buf_ptr = buf_ptr->next_buffer_ptr)
     {
-        if (buf_ptr->data_size + bufferPos > sizeof(buffer))
+        if (0 == buf_ptr->data_size)
+            continue;
+        if (TX_MAX_SEGMENTS == iovCnt)
         {
-            UCSI_CB_OnUserMessage(my->tag, true, "TX buffer is too small, increase " \
-                "BOARD_PMS_TX_SIZE define (%lu > %lu)", 2, buf_ptr->data_size + bufferPos, sizeof(buffer));
+            UCSI_CB_OnUserMessage(my->tag, true, "TX telegram has too many segments, increase " \
+                "TX_MAX_SEGMENTS define (%d)", 1, TX_MAX_SEGMENTS);
             my->uniLld->tx_release_fptr(my->uniLldHPtr, msg_ptr);
             return;
         }
-        memcpy(&buffer[bufferPos], buf_ptr->data_ptr, buf_ptr->data_size);
-        bufferPos += buf_ptr->data_size;
+        iov[iovCnt].iov_base = buf_ptr->data_ptr;
+        iov[iovCnt].iov_len = buf_ptr->data_size;
+        ++iovCnt;
     }
-    assert(bufferPos == msg_ptr->memory_ptr->total_size);
-    my->uniLld->tx_release_fptr(my->uniLldHPtr, msg_ptr);
-    UCSI_CB_OnTxRequest(my->tag, buffer, bufferPos);
+    /* Message is released by UCSI_TxRelease, once the LLD accepted the data */
+    UCSI_CB_OnTxRequest(my->tag, iov, iovCnt, msg_ptr);
 }
 
 static void OnUnicensRoutingResult(Ucs_Rm_Route_t* route_ptr, Ucs_Rm_RouteInfos_t route_infos, void *user_ptr)
@@ -577,7 +1917,10 @@ static void OnUnicensDebugXrmResources(Ucs_Xrm_ResourceType_t resource_type,
     Ucs_Xrm_ResObject_t *resource_ptr, Ucs_Xrm_ResourceInfos_t resource_infos,
     Ucs_Rm_EndPoint_t *endpoint_inst_ptr, void *user_ptr)
 {
-    char *msg = NULL;
+    const char *msg = NULL;
+    const char *fmt = NULL;
+    uint32_t args[UCS_TRACE_MAX_ARGS];
+    uint8_t argCnt = 0;
     UCSI_Data_t *my;
     uint16_t adr = 0xFFFF;
 #ifndef DEBUG_XRM
@@ -587,7 +1930,7 @@ static void OnUnicensDebugXrmResources(Ucs_Xrm_ResourceType_t resource_type,
     endpoint_inst_ptr = endpoint_inst_ptr;
     user_ptr = user_ptr;
 #else
-    endpoint_inst_ptr = endpoint_inst_ptr;
+    /* only raw values are recorded here, UcsTrace_Format decodes them on demand */
     my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
     if (NULL == resource_ptr) return;
@@ -597,16 +1940,16 @@ static void OnUnicensDebugXrmResources(Ucs_Xrm_ResourceType_t resource_type,
     switch (resource_infos)
     {
         case UCS_XRM_INFOS_BUILT:
-        msg = (char *)"has been built";
+        msg = "has been built";
         break;
         case UCS_XRM_INFOS_DESTROYED:
-        msg = (char *)"has been destroyed";
+        msg = "has been destroyed";
         break;
         case UCS_XRM_INFOS_ERR_BUILT:
-        msg = (char *)"cannot be built";
+        msg = "cannot be built";
         break;
         default:
-        msg = (char *)"cannot be destroyed";
+        msg = "cannot be destroyed";
         break;
     }
     switch(resource_type)
@@ -615,142 +1958,170 @@ static void OnUnicensDebugXrmResources(Ucs_Xrm_ResourceType_t resource_type,
         {
             Ucs_Xrm_MostSocket_t *ms = (Ucs_Xrm_MostSocket_t *)resource_ptr;
             assert(ms->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): MOST socket %s, handle=%04X, "\
-                "direction=%d, type=%d, bandwidth=%d", 6, adr, msg, ms->most_port_handle,
-                ms->direction, ms->data_type, ms->bandwidth);
+            fmt = "MOST socket, handle=%04X, direction=%d, type=%d, bandwidth=%d";
+            args[argCnt++] = ms->most_port_handle;
+            args[argCnt++] = ms->direction;
+            args[argCnt++] = ms->data_type;
+            args[argCnt++] = ms->bandwidth;
             break;
         }
         case UCS_XRM_RC_TYPE_MLB_PORT:
         {
             Ucs_Xrm_MlbPort_t *m = (Ucs_Xrm_MlbPort_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): MLB port %s, index=%d, clock=%d", 4,
-                adr, msg, m->index, m->clock_config);
+            fmt = "MLB port, index=%d, clock=%d";
+            args[argCnt++] = m->index;
+            args[argCnt++] = m->clock_config;
             break;
         }
         case UCS_XRM_RC_TYPE_MLB_SOCKET:
         {
             Ucs_Xrm_MlbSocket_t *m = (Ucs_Xrm_MlbSocket_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): MLB socket %s, direction=%d, type=%d,"\
-                " bandwidth=%d, channel=%d", 6, adr, msg, m->direction, m->data_type,
-                m->bandwidth, m->channel_address);
+            fmt = "MLB socket, direction=%d, type=%d, bandwidth=%d, channel=%d";
+            args[argCnt++] = m->direction;
+            args[argCnt++] = m->data_type;
+            args[argCnt++] = m->bandwidth;
+            args[argCnt++] = m->channel_address;
             break;
         }
         case UCS_XRM_RC_TYPE_USB_PORT:
         {
             Ucs_Xrm_UsbPort_t *m = (Ucs_Xrm_UsbPort_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): USB port %s, in-cnt=%d, out-cnt=%d", 4,
-                adr, msg, m->streaming_if_ep_in_count, m->streaming_if_ep_out_count);
+            fmt = "USB port, in-cnt=%d, out-cnt=%d";
+            args[argCnt++] = m->streaming_if_ep_in_count;
+            args[argCnt++] = m->streaming_if_ep_out_count;
             break;
         }
         case UCS_XRM_RC_TYPE_USB_SOCKET:
         {
             Ucs_Xrm_UsbSocket_t *m = (Ucs_Xrm_UsbSocket_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): USB socket %s, direction=%d, type=%d," \
-                " ep-addr=%02X, frames=%d", 6, adr, msg, m->direction, m->data_type,
-                m->end_point_addr, m->frames_per_transfer);
+            fmt = "USB socket, direction=%d, type=%d, ep-addr=%02X, frames=%d";
+            args[argCnt++] = m->direction;
+            args[argCnt++] = m->data_type;
+            args[argCnt++] = m->end_point_addr;
+            args[argCnt++] = m->frames_per_transfer;
             break;
         }
         case UCS_XRM_RC_TYPE_STRM_PORT:
         {
             Ucs_Xrm_StrmPort_t *m = (Ucs_Xrm_StrmPort_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): I2S port %s, index=%d, clock=%d, "\
-                "align=%d", 5, adr, msg, m->index, m->clock_config, m->data_alignment);
+            fmt = "I2S port, index=%d, clock=%d, align=%d";
+            args[argCnt++] = m->index;
+            args[argCnt++] = m->clock_config;
+            args[argCnt++] = m->data_alignment;
             break;
         }
         case UCS_XRM_RC_TYPE_STRM_SOCKET:
         {
             Ucs_Xrm_StrmSocket_t *m = (Ucs_Xrm_StrmSocket_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): I2S socket %s, direction=%d, type=%d"\
-                ", bandwidth=%d, pin=%d", 6, adr, msg, m->direction, m->data_type,
-                m->bandwidth, m->stream_pin_id);
+            fmt = "I2S socket, direction=%d, type=%d, bandwidth=%d, pin=%d";
+            args[argCnt++] = m->direction;
+            args[argCnt++] = m->data_type;
+            args[argCnt++] = m->bandwidth;
+            args[argCnt++] = m->stream_pin_id;
             break;
         }
         case UCS_XRM_RC_TYPE_SYNC_CON:
         {
             Ucs_Xrm_SyncCon_t *m = (Ucs_Xrm_SyncCon_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): Sync connection %s, mute=%d, "\
-                "offset=%d", 4, adr, msg, m->mute_mode, m->offset);
+            fmt = "Sync connection, mute=%d, offset=%d";
+            args[argCnt++] = m->mute_mode;
+            args[argCnt++] = m->offset;
             break;
         }
         case UCS_XRM_RC_TYPE_COMBINER:
         {
             Ucs_Xrm_Combiner_t *m = (Ucs_Xrm_Combiner_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): Combiner %s, bytes per frame=%d",
-                3, adr, msg, m->bytes_per_frame);
+            fmt = "Combiner, bytes per frame=%d";
+            args[argCnt++] = m->bytes_per_frame;
             break;
         }
         case UCS_XRM_RC_TYPE_SPLITTER:
         {
             Ucs_Xrm_Splitter_t *m = (Ucs_Xrm_Splitter_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): Splitter %s, bytes per frame=%d",
-                3, adr, msg, m->bytes_per_frame);
+            fmt = "Splitter, bytes per frame=%d";
+            args[argCnt++] = m->bytes_per_frame;
             break;
         }
         case UCS_XRM_RC_TYPE_AVP_CON:
         {
             Ucs_Xrm_AvpCon_t *m = (Ucs_Xrm_AvpCon_t *)resource_ptr;
             assert(m->resource_type == resource_type);
-            UCSI_CB_OnUserMessage(my->tag, false, "Xrm-Debug (0x%03X): Isoc-AVP connection %s, packetSize=%d",
-                3, adr, msg, m->isoc_packet_size);
+            fmt = "Isoc-AVP connection, packetSize=%d";
+            args[argCnt++] = m->isoc_packet_size;
             break;
         }
         default:
-        UCSI_CB_OnUserMessage(my->tag, true, "Xrm-Debug (0x%03X): Unknown type=%d %s", 3 , adr, resource_type, msg);
+        fmt = "Unknown type=%d";
+        args[argCnt++] = resource_type;
+        break;
     }
+    UcsTrace_Add(&my->trace, UcsTrace_Xrm, UCSI_GetTimeUs(my), adr, msg, fmt, argCnt, args);
+    /* failures are reported right away as well */
+    if (UCS_XRM_INFOS_ERR_BUILT == resource_infos || UCS_XRM_INFOS_ERR_DESTROYED == resource_infos)
+        UCSI_CB_OnUserMessage(my->tag, true, "Xrm-Debug (0x%03X): resource type=%d %s", 3, adr, resource_type, msg);
 #endif
 }
 
 static void OnUcsInitResult(Ucs_InitResult_t result, void *user_ptr)
 {
-    UnicensCmdEntry_t e;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
     my->initialized = (UCS_INIT_RES_SUCCESS == result);
-    OnCommandExecuted(my, UnicensCmd_Init);
+    OnCommandExecuted(my, UnicensCmd_Init, 0);
     if (!my->initialized)
     {
         UCSI_CB_OnUserMessage(my->tag, true, "UcsInitResult reported error (0x%X), restarting...", 1, result);
-        e.cmd = UnicensCmd_Init;
-        e.val.Init.init_ptr = &my->uniInitData;
-        EnqueueCommand(my, &e);
+        WarmRestart(my);
     }
 }
 
 static void OnUcsStopResult(Ucs_StdResult_t result, void *user_ptr)
 {
+    uint8_t i;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     result = result; /*TODO: check error case*/
     assert(MAGIC == my->magic);
     my->initialized = false;
-    OnCommandExecuted(my, UnicensCmd_Stop);
+    for (i = 0; i < my->nodeTable.count; i++)
+    {
+        my->nodeTable.nodes[i].available = false;
+        my->nodeTable.nodes[i].gpioPortHandle = 0;
+        my->nodeTable.nodes[i].i2cPortHandle = 0;
+    }
+    OnCommandExecuted(my, UnicensCmd_Stop, 0);
     UCSI_CB_OnStop(my->tag);
 }
 
 static void OnUcsGpioPortCreate(uint16_t node_address, uint16_t gpio_port_handle, Ucs_Gpio_Result_t result, void *user_ptr)
 {
+    UCSI_NodeState_t *n;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
-    OnCommandExecuted(my, UnicensCmd_GpioCreatePort);
+    n = NodeTable_Get(&my->nodeTable, node_address, false);
+    if (NULL != n && UCS_GPIO_RES_SUCCESS == result.code)
+        n->gpioPortHandle = gpio_port_handle;
+    OnCommandExecuted(my, UnicensCmd_GpioCreatePort, node_address);
 }
 
 static void OnUcsGpioPortWrite(uint16_t node_address, uint16_t gpio_port_handle, uint16_t current_state, uint16_t sticky_state, Ucs_Gpio_Result_t result, void *user_ptr)
 {
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
-    OnCommandExecuted(my, UnicensCmd_GpioWritePort);
+    OnCommandExecuted(my, UnicensCmd_GpioWritePort, node_address);
 }
 
 static void OnUcsMgrReport(Ucs_MgrReport_t code, uint16_t node_address, Ucs_Rm_Node_t *node_ptr, void *user_ptr)
 {
+    UCSI_NodeState_t *n;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
     switch (code)
@@ -764,23 +2135,64 @@ static void OnUcsMgrReport(Ucs_MgrReport_t code, uint16_t node_address, Ucs_Rm_N
     case UCS_MGR_REP_AVAILABLE:
     {
         UnicensCmdEntry_t e;
+        bool configured;
         UCSI_CB_OnUserMessage(my->tag, false, "Node=%X: Available", 1, node_address);
-        /* Enable usage of remote GPIO ports */
-        e.cmd = UnicensCmd_GpioCreatePort;
-        e.val.GpioCreatePort.destination = node_address;
-        e.val.GpioCreatePort.debounceTime = 20;
-        EnqueueCommand(my, &e);
-        /* Execute scripts, if there are any */
-        if (node_ptr && node_ptr->script_list_ptr && node_ptr->script_list_size)
+        /* results of commands expired before the node came back will not show up anymore */
+        ForgetExpired(my, UNICENS_CMD_COUNT, node_address);
+        /* configured nodes are all known since NodeTable_Load */
+        configured = (NULL != NodeTable_Get(&my->nodeTable, node_address, false));
+        n = NodeTable_Get(&my->nodeTable, node_address, true);
+        if (NULL != n)
+        {
+            n->available = true;
+            n->availableCnt++;
+            n->gpioPortHandle = 0;
+            n->i2cPortHandle = 0;
+            if (NULL != node_ptr)
+                n->node = node_ptr;
+        }
+        /* Configured nodes using GPIO and unconfigured ones get their port now, others on their first GPIO write */
+        if (!configured || NULL == n || n->gpioEager)
+        {
+            e.cmd = UnicensCmd_GpioCreatePort;
+            e.val.GpioCreatePort.destination = node_address;
+            e.val.GpioCreatePort.debounceTime = GPIO_DEBOUNCE_MS;
+            EnqueueCommand(my, &e);
+        }
+        /* Execute scripts, if there are any and the node did not keep them over a restart */
+        if (NULL != n && UCSI_ScriptState_Succeeded == n->scriptState)
+        {
+            UCSI_CB_OnUserMessage(my->tag, false, "Node=%X: Script kept, not executed again", 1, node_address);
+            my->restartStats.scriptsSkipped++;
+        }
+        else if (NULL != n && UCSI_ScriptPolicy_SkipUnchanged == my->scriptPolicy
+            && 0 != n->scriptFingerprint && ScriptFingerprint(node_ptr) == n->scriptFingerprint)
+        {
+            UCSI_CB_OnUserMessage(my->tag, false, "Node=%X: Script unchanged, not executed again", 1, node_address);
+            n->scriptState = UCSI_ScriptState_Succeeded;
+            my->restartStats.scriptsUnchanged++;
+        }
+        else if (node_ptr && node_ptr->script_list_ptr && node_ptr->script_list_size)
         {
             e.cmd = UnicensCmd_NsRun;
             e.val.NsRun.node_ptr = node_ptr;
-            EnqueueCommand(my, &e);
+            if (EnqueueCommand(my, &e) && NULL != n)
+                n->scriptState = UCSI_ScriptState_Pending;
         }
         break;
     }
     case UCS_MGR_REP_NOT_AVAILABLE:
         UCSI_CB_OnUserMessage(my->tag, false, "Node=%X: Not available", 1, node_address);
+        ForgetExpired(my, UNICENS_CMD_COUNT, node_address);
+        n = NodeTable_Get(&my->nodeTable, node_address, false);
+        if (NULL != n)
+        {
+            n->available = false;
+            n->gpioPortHandle = 0;
+            n->i2cPortHandle = 0;
+            /* the node may get reset, its script must run again */
+            n->scriptState = UCSI_ScriptState_None;
+        }
         break;
     default:
         UCSI_CB_OnUserMessage(my->tag, true, "Node=%X: unknown code", 1, node_address);
@@ -792,18 +2204,27 @@ static void OnUcsMgrReport(Ucs_MgrReport_t code, uint16_t node_address, Ucs_Rm_N
 
 static void OnUcsNsRun(Ucs_Rm_Node_t * node_ptr, Ucs_Ns_ResultCode_t result, void *ucs_user_ptr)
 {
-    UCSI_Data_t *my;
-#ifndef DEBUG_XRM
-    node_ptr = node_ptr;
-    result = result;
-    ucs_user_ptr;
-#else
-    my = (UCSI_Data_t *)ucs_user_ptr;
+    UCSI_NodeState_t *n;
+    UCSI_Cmd_t *c;
+    uint32_t durationMs = 0;
+    uint16_t nodeAddress = node_ptr->signature_ptr->node_address;
+    UCSI_Data_t *my = (UCSI_Data_t *)ucs_user_ptr;
     assert(MAGIC == my->magic);
-    UCSI_CB_OnUserMessage(my->tag, false, "OnUcsNsRun (%03X): script executed %s",
-        2, node_ptr->signature_ptr->node_address,
-        (UCS_NS_RES_SUCCESS == result ? "succeeded" : "false"));
-#endif
+    c = FindInFlight(my, UnicensCmd_NsRun, nodeAddress);
+    if (NULL != c)
+        durationMs = (uint32_t)((UCSI_GetTimeUs(my) - c->dispatchedUs) / 1000);
+    n = NodeTable_Get(&my->nodeTable, nodeAddress, false);
+    if (NULL != n)
+    {
+        n->scriptState = (UCS_NS_RES_SUCCESS == result) ? UCSI_ScriptState_Succeeded : UCSI_ScriptState_Failed;
+        n->scriptFingerprint = (UCS_NS_RES_SUCCESS == result) ? ScriptFingerprint(node_ptr) : 0;
+        n->scriptDurationMs = durationMs;
+    }
+    OnCommandExecuted(my, UnicensCmd_NsRun, nodeAddress);
+    UcsTrace_Add(&my->trace, UcsTrace_NsRun, UCSI_GetTimeUs(my), nodeAddress,
+        (UCS_NS_RES_SUCCESS == result ? "succeeded" : "failed"), "script executed after %u ms", 1, &durationMs);
+    if (UCS_NS_RES_SUCCESS != result)
+        UCSI_CB_OnUserMessage(my->tag, true, "OnUcsNsRun (%03X): script failed after %u ms", 2, nodeAddress, durationMs);
 }
 
 static void OnUcsAmsRxMsgReceived(void *user_ptr)
@@ -813,12 +2234,58 @@ static void OnUcsAmsRxMsgReceived(void *user_ptr)
     UCSI_CB_OnAmsMessageReceived(my->tag);
 }
 
+static void OnUcsAmsTxComplete(Ucs_AmsTx_Msg_t *msg_ptr, Ucs_AmsTx_Result_t result, Ucs_AmsTx_Info_t info, void *user_ptr)
+{
+    UCSI_AmsTxCtx_t *ctx;
+    UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
+    assert(MAGIC == my->magic);
+    info = info;
+    ctx = (UCSI_AmsTxCtx_t *)msg_ptr->custom_info_ptr;
+    if (NULL != ctx && NULL != ctx->result_fptr)
+        ctx->result_fptr(&result, ctx->request_ptr);
+    /* UNICENS frees the message itself after this callback */
+    msg_ptr->custom_info_ptr = NULL;
+    AmsTxCtx_Free(my, ctx);
+}
+
+static void AmsTxCtx_Init(UCSI_Data_t *my)
+{
+    uint16_t i;
+    my->amsTxFree = NULL;
+    for (i = 0; i < UCS_AMS_NUM_TX_MSGS; i++)
+    {
+        my->amsTxCtx[i].next = my->amsTxFree;
+        my->amsTxFree = &my->amsTxCtx[i];
+    }
+    my->amsTxStarved = false;
+}
+
+/* Gives a completion context back and resumes a starved sender */
+static void AmsTxCtx_Free(UCSI_Data_t *my, UCSI_AmsTxCtx_t *ctx)
+{
+    if (NULL != ctx)
+    {
+        ctx->result_fptr = NULL;
+        ctx->next = my->amsTxFree;
+        my->amsTxFree = ctx;
+    }
+    if (my->amsTxStarved)
+    {
+        my->amsTxStarved = false;
+        UCSI_CB_OnAmsTxAvailable(my->tag);
+    }
+}
+
 static void OnUcsGpioTriggerEventStatus(uint16_t node_address, uint16_t gpio_port_handle,
     uint16_t rising_edges, uint16_t falling_edges, uint16_t levels, void * user_ptr)
 {
     uint8_t i;
+    UCSI_NodeState_t *n;
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
     assert(MAGIC == my->magic);
+    n = NodeTable_Get(&my->nodeTable, node_address, false);
+    if (NULL != n)
+        n->gpioLevels = levels;
     for (i = 0; i < 16; i++)
     {
         if (0 != ((rising_edges >> i) & 0x1))
@@ -832,18 +2299,20 @@ static void OnUcsI2CWrite(uint16_t node_address, uint16_t i2c_port_handle,
     uint8_t i2c_slave_address, uint8_t data_len, Ucs_I2c_Result_t result, void *user_ptr)
 {
     UCSI_Data_t *my = (UCSI_Data_t *)user_ptr;
+    UCSI_NodeState_t *n;
+    UCSI_Cmd_t *c;
     assert(MAGIC == my->magic);
+    n = NodeTable_Get(&my->nodeTable, node_address, false);
+    if (NULL != n && UCS_I2C_RES_SUCCESS == result.code)
+        n->i2cPortHandle = i2c_port_handle;
+    c = FindInFlight(my, UnicensCmd_I2CWrite, node_address);
+    /* the requester already got a timeout result */
+    if (NULL == c && IsLateResult(my, UnicensCmd_I2CWrite, node_address))
+        return;
+    if (c)
+        NotifyI2cWrite(my, c, &result.code);
     
-    if ((my->currentCmd->cmd == UnicensCmd_I2CWrite) 
-        && (my->currentCmd->val.I2CWrite.result_fptr)) {
-        
-        my->currentCmd->val.I2CWrite.result_fptr(&result.code, my->currentCmd->val.I2CWrite.request_ptr);
-    }
-    else {
-        assert(false);
-    }
-    
-    OnCommandExecuted(my, UnicensCmd_I2CWrite);
+    OnCommandExecuted(my, UnicensCmd_I2CWrite, node_address);
     if (UCS_I2C_RES_SUCCESS != result.code)
         UCSI_CB_OnUserMessage(my->tag, true, "Remote I2C Write to node=0x%X failed", 1, node_address);
 }
@@ -854,19 +2323,37 @@ static void OnUcsI2CWrite(uint16_t node_address, uint16_t i2c_port_handle,
 #if defined(UCS_TR_ERROR) || defined(UCS_TR_INFO)
 #include <stdio.h>
 #define TRACE_BUFFER_SZ 200
+/* Integer arguments are kept raw in the trace ring, any other format is stored without them */
+static uint8_t TraceArgs(const char *format, uint32_t *args, uint16_t vargs_cnt, va_list argptr)
+{
+    uint8_t i;
+    if (!UcsTrace_IsIntegerFormat(format))
+        return 0;
+    for (i = 0; i < vargs_cnt && i < UCS_TRACE_MAX_ARGS; i++)
+        args[i] = va_arg(argptr, uint32_t);
+    return i;
+}
+
 void App_TraceError(void *ucs_user_ptr, const char module_str[], const char entry_str[], uint16_t vargs_cnt, ...)
 {
     va_list argptr;
     char outbuf[TRACE_BUFFER_SZ];
+    uint32_t args[UCS_TRACE_MAX_ARGS];
+    uint8_t argCnt;
     void *tag = NULL;
     UCSI_Data_t *my = (UCSI_Data_t *)ucs_user_ptr;
     if (my)
     {
         assert(MAGIC == my->magic);
         tag = my->tag;
+        va_start(argptr, vargs_cnt);
+        argCnt = TraceArgs(entry_str, args, vargs_cnt, argptr);
+        va_end(argptr);
+        UcsTrace_Add(&my->trace, UcsTrace_Error, UCSI_GetTimeUs(my), 0xFFFF, module_str, entry_str, argCnt, args);
     }
+    /* errors are rare and reported right away as well */
     va_start(argptr, vargs_cnt);
-    vsprintf(outbuf, entry_str, argptr);
+    vsnprintf(outbuf, sizeof(outbuf), entry_str, argptr);
     va_end(argptr);
     UCSI_CB_OnUserMessage(tag, true, "Error | %s | %s", 2, module_str, outbuf);
 }
@@ -874,17 +2361,15 @@ void App_TraceError(void *ucs_user_ptr, const char module_str[], const char entr
 void App_TraceInfo(void *ucs_user_ptr, const char module_str[], const char entry_str[], uint16_t vargs_cnt, ...)
 {
     va_list argptr;
-    char outbuf[TRACE_BUFFER_SZ];
-    void *tag = NULL;
+    uint32_t args[UCS_TRACE_MAX_ARGS];
+    uint8_t argCnt;
     UCSI_Data_t *my = (UCSI_Data_t *)ucs_user_ptr;
-    if (my)
-    {
-        assert(MAGIC == my->magic);
-        tag = my->tag;
-    }
+    if (NULL == my)
+        return;
+    assert(MAGIC == my->magic);
     va_start(argptr, vargs_cnt);
-    vsprintf(outbuf, entry_str, argptr);
+    argCnt = TraceArgs(entry_str, args, vargs_cnt, argptr);
     va_end(argptr);
-    UCSI_CB_OnUserMessage(tag, false, "Info | %s | %s", 2, module_str, outbuf);
+    UcsTrace_Add(&my->trace, UcsTrace_Info, UCSI_GetTimeUs(my), 0xFFFF, module_str, entry_str, argCnt, args);
 }
 #endif
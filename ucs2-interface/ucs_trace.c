@@ -0,0 +1,182 @@
+/*------------------------------------------------------------------------------------------------*/
+/* UNICENS Integration Helper Component                                                           */
+/* Copyright 2017, Microchip Technology Inc. and its subsidiaries.                                */
+/*                                                                                                */
+/* Redistribution and use in source and binary forms, with or without                             */
+/* modification, are permitted provided that the following conditions are met:                    */
+/*                                                                                                */
+/* 1. Redistributions of source code must retain the above copyright notice, this                 */
+/*    list of conditions and the following disclaimer.                                            */
+/*                                                                                                */
+/* 2. Redistributions in binary form must reproduce the above copyright notice,                   */
+/*    this list of conditions and the following disclaimer in the documentation                   */
+/*    and/or other materials provided with the distribution.                                      */
+/*                                                                                                */
+/* 3. Neither the name of the copyright holder nor the names of its                               */
+/*    contributors may be used to endorse or promote products derived from                        */
+/*    this software without specific prior written permission.                                    */
+/*                                                                                                */
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"                    */
+/* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE                      */
+/* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE                 */
+/* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE                   */
+/* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL                     */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR                     */
+/* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER                     */
+/* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,                  */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE                  */
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                           */
+/*------------------------------------------------------------------------------------------------*/
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "ucs_trace.h"
+
+/************************************************************************/
+/* Public Function Implementations                                      */
+/************************************************************************/
+
+void UcsTrace_Init(UcsTrace_Ring_t *ring)
+{
+    uint16_t i;
+    assert(NULL != ring);
+    atomic_init(&ring->head, 0);
+    for (i = 0; i < UCS_TRACE_LEN; i++)
+        atomic_init(&ring->slots[i].seq, i + 1u);
+}
+
+void UcsTrace_Add(UcsTrace_Ring_t *ring, UcsTrace_Event_t event, uint64_t timeUs, uint16_t nodeAddress,
+    const char *label, const char *format, uint8_t argCnt, const uint32_t *args)
+{
+    uint32_t seq;
+    UcsTrace_Record_t *rec;
+    if (NULL == ring) return;
+    /* every writer owns its slot by the sequence number it drew */
+    seq = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    /* seq + 1 never belongs to this slot, even when the counter wraps */
+    atomic_store_explicit(&ring->slots[seq % UCS_TRACE_LEN].seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    rec = &ring->slots[seq % UCS_TRACE_LEN].rec;
+    rec->seq = seq;
+    rec->timeUs = timeUs;
+    rec->event = (uint16_t)event;
+    rec->nodeAddress = nodeAddress;
+    rec->label = label;
+    rec->format = format;
+    if (argCnt > UCS_TRACE_MAX_ARGS)
+        argCnt = UCS_TRACE_MAX_ARGS;
+    if (!UcsTrace_IsIntegerFormat(format))
+        argCnt = 0;
+    rec->argCnt = argCnt;
+    memset(rec->args, 0, sizeof(rec->args));
+    if (0 != argCnt && NULL != args)
+        memcpy(rec->args, args, argCnt * sizeof(uint32_t));
+    atomic_store_explicit(&ring->slots[seq % UCS_TRACE_LEN].seq, seq, memory_order_release);
+}
+
+bool UcsTrace_IsIntegerFormat(const char *format)
+{
+    uint8_t convCnt = 0;
+    if (NULL == format) return false;
+    while ('\0' != *format)
+    {
+        if ('%' != *format++)
+            continue;
+        if ('%' == *format)
+        {
+            format++;
+            continue;
+        }
+        /* flags, width and precision, '*' would take an argument of its own */
+        while ('\0' != *format && NULL != strchr("-+ #0123456789.", *format))
+            format++;
+        /* only short lengths, l, ll, j, z, t, L and q change the argument size */
+        while ('h' == *format)
+            format++;
+        if ('\0' == *format || NULL == strchr("diouxXc", *format))
+            return false;
+        format++;
+        if (++convCnt > UCS_TRACE_MAX_ARGS)
+            return false;
+    }
+    return true;
+}
+
+uint16_t UcsTrace_Read(UcsTrace_Ring_t *ring, uint32_t *pSince, UcsTrace_Record_t *pRecords,
+    uint16_t maxCount, uint32_t *pLost)
+{
+    uint32_t head, since, seqBefore, seqAfter;
+    uint32_t lost = 0;
+    uint16_t cnt = 0;
+    assert(NULL != ring && NULL != pSince && NULL != pRecords);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    since = *pSince;
+    /* sequence numbers wrap, so only their distance counts */
+    if (head - since > UCS_TRACE_LEN && head - since < UINT32_MAX / 2)
+    {
+        lost = head - UCS_TRACE_LEN - since;
+        since = head - UCS_TRACE_LEN;
+    }
+    else if (head - since >= UINT32_MAX / 2)
+    {
+        /* reader is ahead, e.g. after a restart */
+        since = head;
+    }
+    for (; since != head && cnt < maxCount; since++)
+    {
+        seqBefore = atomic_load_explicit(&ring->slots[since % UCS_TRACE_LEN].seq, memory_order_acquire);
+        if (seqBefore != since)
+        {
+            /* still being written or already overwritten */
+            lost++;
+            continue;
+        }
+        memcpy(&pRecords[cnt], &ring->slots[since % UCS_TRACE_LEN].rec, sizeof(UcsTrace_Record_t));
+        atomic_thread_fence(memory_order_acquire);
+        seqAfter = atomic_load_explicit(&ring->slots[since % UCS_TRACE_LEN].seq, memory_order_relaxed);
+        if (seqAfter != seqBefore)
+        {
+            lost++;
+            continue;
+        }
+        cnt++;
+    }
+    *pSince = since;
+    if (NULL != pLost)
+        *pLost = lost;
+    return cnt;
+}
+
+void UcsTrace_Format(const UcsTrace_Record_t *rec, char *buffer, size_t bufferLen)
+{
+    char text[200];
+    const uint32_t *a;
+    const char *label;
+    assert(NULL != rec && NULL != buffer && 0 != bufferLen);
+    a = rec->args;
+    label = (NULL != rec->label) ? rec->label : "";
+    if (NULL == rec->format)
+        text[0] = '\0';
+    else if (UcsTrace_IsIntegerFormat(rec->format))
+        snprintf(text, sizeof(text), rec->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+    else
+        snprintf(text, sizeof(text), "%s", rec->format);
+    switch (rec->event)
+    {
+    case UcsTrace_Error:
+        snprintf(buffer, bufferLen, "Error | %s | %s", label, text);
+        break;
+    case UcsTrace_Info:
+        snprintf(buffer, bufferLen, "Info | %s | %s", label, text);
+        break;
+    case UcsTrace_Xrm:
+        snprintf(buffer, bufferLen, "Xrm-Debug (0x%03X): %s, %s", rec->nodeAddress, text, label);
+        break;
+    case UcsTrace_NsRun:
+        snprintf(buffer, bufferLen, "OnUcsNsRun (%03X): %s, %s", rec->nodeAddress, text, label);
+        break;
+    default:
+        snprintf(buffer, bufferLen, "Unknown event=%d (0x%03X): %s", rec->event, rec->nodeAddress, text);
+        break;
+    }
+}
@@ -0,0 +1,162 @@
+/*------------------------------------------------------------------------------------------------*/
+/* UNICENS Integration Helper Component                                                           */
+/* Copyright 2017, Microchip Technology Inc. and its subsidiaries.                                */
+/*                                                                                                */
+/* Redistribution and use in source and binary forms, with or without                             */
+/* modification, are permitted provided that the following conditions are met:                    */
+/*                                                                                                */
+/* 1. Redistributions of source code must retain the above copyright notice, this                 */
+/*    list of conditions and the following disclaimer.                                            */
+/*                                                                                                */
+/* 2. Redistributions in binary form must reproduce the above copyright notice,                   */
+/*    this list of conditions and the following disclaimer in the documentation                   */
+/*    and/or other materials provided with the distribution.                                      */
+/*                                                                                                */
+/* 3. Neither the name of the copyright holder nor the names of its                               */
+/*    contributors may be used to endorse or promote products derived from                        */
+/*    this software without specific prior written permission.                                    */
+/*                                                                                                */
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"                    */
+/* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE                      */
+/* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE                 */
+/* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE                   */
+/* FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL                     */
+/* DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR                     */
+/* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER                     */
+/* CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,                  */
+/* OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE                  */
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                           */
+/*------------------------------------------------------------------------------------------------*/
+#ifndef UCSTRACE_H_
+#define UCSTRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define UCS_TRACE_LEN           (256) /* records kept, must be a power of two */
+#define UCS_TRACE_MAX_ARGS      (6)
+
+/**
+ * \brief Kind of a trace record, selects how UcsTrace_Format decodes it
+ */
+typedef enum
+{
+    /** Error trace of the UNICENS stack */
+    UcsTrace_Error,
+    /** Info trace of the UNICENS stack */
+    UcsTrace_Info,
+    /** Resource of the routing manager was built or destroyed */
+    UcsTrace_Xrm,
+    /** Node script finished */
+    UcsTrace_NsRun
+} UcsTrace_Event_t;
+
+/**
+ * \brief One trace event, stored without formatting
+ */
+typedef struct
+{
+    /** Sequence number, counts all records ever added */
+    uint32_t seq;
+    /** Event time in microseconds */
+    uint64_t timeUs;
+    /** see UcsTrace_Event_t */
+    uint16_t event;
+    /** Node address the event belongs to, 0xFFFF if none */
+    uint16_t nodeAddress;
+    uint8_t argCnt;
+    /** Static label of the event, e.g. the UNICENS module or the resource state */
+    const char *label;
+    /** Static printf format of the event, printed raw unless UcsTrace_IsIntegerFormat accepts it */
+    const char *format;
+    uint32_t args[UCS_TRACE_MAX_ARGS];
+} UcsTrace_Record_t;
+
+/**
+ * \brief Ring of trace records. Adding never blocks and overwrites the oldest records.
+ */
+typedef struct
+{
+    atomic_uint head;
+    struct
+    {
+        /**
+         * Sequence number of the record. Slot i only holds numbers equal to i modulo
+         * UCS_TRACE_LEN, any other value (sequence number + 1) marks it free or being written.
+         */
+        atomic_uint seq;
+        UcsTrace_Record_t rec;
+    } slots[UCS_TRACE_LEN];
+} UcsTrace_Ring_t;
+
+/*>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>*/
+/*                            Public API                                */
+/*>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>*/
+
+/**
+ * \brief Empties the given ring
+ * \param ring - Ring to be initialized
+ */
+void UcsTrace_Init(UcsTrace_Ring_t *ring);
+
+/**
+ * \brief Adds a record to the ring
+ * \note May be called from any thread (not from ISR)
+ *
+ * \param ring - Ring to add to
+ * \param event - see UcsTrace_Event_t
+ * \param timeUs - Event time in microseconds
+ * \param nodeAddress - Node address the event belongs to, 0xFFFF if none
+ * \param label - Static string, kept as pointer
+ * \param format - Static printf format, kept as pointer. Arguments are dropped unless
+ *                 UcsTrace_IsIntegerFormat accepts it.
+ * \param argCnt - Amount of arguments in args, at most UCS_TRACE_MAX_ARGS are kept
+ * \param args - Raw arguments of format
+ */
+void UcsTrace_Add(UcsTrace_Ring_t *ring, UcsTrace_Event_t event, uint64_t timeUs, uint16_t nodeAddress,
+    const char *label, const char *format, uint8_t argCnt, const uint32_t *args);
+
+/**
+ * \brief Checks whether a format can be stored with raw arguments
+ *
+ * \param format - printf format
+ * \return true, if it has at most UCS_TRACE_MAX_ARGS conversions and all of them take
+ *         a 32 bit integer (no strings, pointers, floats, 64 bit values, %n or *)
+ */
+bool UcsTrace_IsIntegerFormat(const char *format);
+
+/**
+ * \brief Copies the records, starting at the given sequence number
+ * \note May be called from any thread (not from ISR), concurrently to UcsTrace_Add
+ *
+ * \param ring - Ring to read from
+ * \param pSince - Sequence number of the first record wanted, will be set to the one following the last copied
+ * \param pRecords - Records will be copied to this array
+ * \param maxCount - Size of pRecords
+ * \param pLost - Will be set to the amount of wanted records, which were already overwritten. May be NULL.
+ * \return Amount of records copied
+ */
+uint16_t UcsTrace_Read(UcsTrace_Ring_t *ring, uint32_t *pSince, UcsTrace_Record_t *pRecords,
+    uint16_t maxCount, uint32_t *pLost);
+
+/**
+ * \brief Decodes a record to human readable text. Formats not taking integer arguments
+ *        only are printed as they are.
+ *
+ * \param rec - Record to decode
+ * \param buffer - Text will be written to this buffer, always zero terminated
+ * \param bufferLen - Size of buffer
+ */
+void UcsTrace_Format(const UcsTrace_Record_t *rec, char *buffer, size_t bufferLen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UCSTRACE_H_ */